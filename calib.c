@@ -0,0 +1,105 @@
+/*==============================================================================
+  Function declarations and data structures for the calibration store
+ =============================================================================*/
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "global.h"
+#include "pwm.h"
+#include "motion.h"
+#include "record.h"
+#include "calib.h"
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+typedef struct CALIB_BLOCK
+{
+    uint8_t version;
+    uint8_t n_channels;
+    uint16_t config[MOTION_MAX_CHANNELS][4];
+
+    /* CRC-16 of everything above */
+    uint16_t crc;
+} CALIB_BLOCK;
+
+_Static_assert(CALIB_EE_ADDR + sizeof(CALIB_BLOCK) <= RECORD_EE_ADDR,
+               "calibration block overlaps the recording");
+
+static CALIB_BLOCK calib;
+static uint8_t calib_valid;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+static uint16_t CALIB_Crc(const CALIB_BLOCK *block)
+{
+    const uint8_t *p = (const uint8_t *) block;
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    for(i = 0; i < offsetof(CALIB_BLOCK, crc); i++)
+        crc = _crc16_update(crc, p[i]);
+    return crc;
+}
+
+/* # Read and check the block
+
+   One bulk read of the whole block, then a CRC over it in RAM; well under
+   a millisecond at boot. A block for a different channel layout is not
+   used.
+*/
+uint8_t CALIB_Init(uint8_t n_channels)
+{
+    eeprom_read_block(&calib, (const void *) CALIB_EE_ADDR, sizeof(calib));
+
+    calib_valid = calib.version == CALIB_VERSION &&
+                  calib.n_channels == n_channels &&
+                  calib.crc == CALIB_Crc(&calib);
+    return calib_valid;
+}
+
+/* # Stored config of channel ch; NULL if not calibrated */
+const uint16_t * CALIB_Config(uint8_t ch)
+{
+    if(!calib_valid || ch >= calib.n_channels)
+        return NULL;
+    return calib.config[ch];
+}
+
+/* # Write the limits of every registry channel to EEPROM
+
+   Only changed bytes are programmed [about 3.3 ms each].
+*/
+void CALIB_Save()
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint8_t ch;
+
+    calib.version = CALIB_VERSION;
+    calib.n_channels = MOTION_Channels();
+    for(ch = 0; ch < MOTION_MAX_CHANNELS; ch++)
+    {
+        pwm = MOTION_Channel(ch, &chn_x);
+        calib.config[ch][0] = (pwm == NULL) ? 0 : pwm->pwm_level_max[chn_x];
+        calib.config[ch][1] = (pwm == NULL) ? 0 : pwm->pwm_level_min[chn_x];
+        calib.config[ch][2] = (pwm == NULL) ? 0 : pwm->pwm_level_idle[chn_x];
+        calib.config[ch][3] = (pwm == NULL) ? 0 : pwm->pwm_step[chn_x];
+    }
+    calib.crc = CALIB_Crc(&calib);
+
+    eeprom_update_block(&calib, (void *) CALIB_EE_ADDR, sizeof(calib));
+    calib_valid = TRUE;
+}
+
+/* # Invalidate the block */
+void CALIB_Erase()
+{
+    eeprom_update_byte((uint8_t *) (CALIB_EE_ADDR + offsetof(CALIB_BLOCK, version)),
+                       0xFF);
+    calib_valid = FALSE;
+}
@@ -0,0 +1,40 @@
+/*==============================================================================
+  Header for the calibration store
+
+    Description
+    -----------
+    Per-channel limits [max, min and idle level, compare counts per level]
+    kept in EEPROM at CALIB_EE_ADDR, so a servo can be retuned without
+    reflashing. The block is read in one eeprom_read_block at init and is
+    only used if its version, channel count and CRC-16 all check out;
+    otherwise every channel keeps the compiled defaults.
+
+    The PWM objects hold the live values; CALIB_Save collects them from the
+    channel registry [MOTION_Channel].
+
+ =============================================================================*/
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdint.h>
+#include "motion.h"
+
+/* EEPROM location of the block; must stay below RECORD_EE_ADDR */
+#define CALIB_EE_ADDR 0x000
+
+/* bumped whenever the block layout changes */
+#define CALIB_VERSION 1
+
+// Read and check the block for n_channels channels; TRUE if it is usable
+extern uint8_t CALIB_Init(uint8_t n_channels);
+
+// Stored config of channel ch [PWM_PwmConfig order]; NULL if not calibrated
+extern const uint16_t * CALIB_Config(uint8_t ch);
+
+// Write the limits of every registry channel to EEPROM
+extern void CALIB_Save(void);
+
+// Invalidate the block; the compiled defaults apply from the next reset
+extern void CALIB_Erase(void);
+
+#endif
@@ -3,6 +3,7 @@
   =============================================================================*/
 
 #include "cmd.h"
+#include "key.h"
 
 /* --------------------------------- */
 /*  Command arguments from terminal  */
@@ -11,6 +12,13 @@
 char *argv[ARGV_SIZE];
 uint8_t argc;
 
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* cmd_table indices sorted by name, for binary search */
+static uint8_t cmd_index[CMD_MAX_COMMANDS];
+
 /* ----------------------------------- */
 /*  Helper functions for parsing etc.  */
 /* ----------------------------------- */
@@ -34,45 +42,126 @@ uint8_t tokenize(char **tokens, char *str_buffer, const char* delim)
     return n_tokens;
 }
 
+/* build the sorted command index
+
+   Insertion sort over cmd_table names, run once at start-up so lookups
+   can binary search. Names are compared through a RAM copy of one side.
+*/
+void cli_Init()
+{
+    char name[CMD_NAME_MAX];
+    uint8_t i, j, k;
+
+    for(i = 0; i < cmd_table_len; i++)
+    {
+        strncpy_P(name, pgm_read_ptr(&cmd_table[i].name), CMD_NAME_MAX - 1);
+        name[CMD_NAME_MAX - 1] = '\0';
+
+        for(j = i; j > 0; j--)
+        {
+            k = cmd_index[j - 1];
+            if(strcmp_P(name, pgm_read_ptr(&cmd_table[k].name)) >= 0) break;
+            cmd_index[j] = k;
+        }
+        cmd_index[j] = i;
+    }
+}
+
+/* look up a command by name; O(log n) strcmp_P calls */
+const CMD_ENTRY * cli_FindCommand(const char *name)
+{
+    const CMD_ENTRY *entry;
+    uint8_t lo = 0, hi = cmd_table_len, mid;
+    int cmp;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        entry = &cmd_table[cmd_index[mid]];
+        cmp = strcmp_P(name, pgm_read_ptr(&entry->name));
+
+        if(cmp == 0) return entry;
+        if(cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+/* print name, arguments and help of every command, sorted */
+void cli_PrintHelp()
+{
+    const CMD_ENTRY *entry;
+    const char *args;
+    uint8_t i;
+
+    uart_SendString_P(PSTR("\n\r# List of commands\n\r\n\r"));
+    for(i = 0; i < cmd_table_len; i++)
+    {
+        entry = &cmd_table[cmd_index[i]];
+        args = pgm_read_ptr(&entry->args);
+
+        uart_SendString_P(pgm_read_ptr(&entry->name));
+        if(pgm_read_byte(args))
+        {
+            uart_SendByte(' ');
+            uart_SendString_P(args);
+        }
+        uart_SendString_P(PSTR(" : "));
+        uart_SendString_P(pgm_read_ptr(&entry->help));
+        uart_SendString_P(PSTR("\n\r"));
+    }
+    uart_SendString_P(PSTR("\n\r"));
+}
+
 /* for parsing commands in cli context */
-void cli_ParseCommand(unsigned int cmd_list_len)
+void cli_ParseCommand()
 {
+    const CMD_ENTRY *entry;
+    CMD_Callback callback;
+
     /* if command execute flag on */
     if(status.cmd_check == TRUE)
     {
         /* new line */
-        uart_SendString("\n\r");
+        uart_SendString_P(PSTR("\n\r"));
 
         /* tokenize UART_RxBuffer */
         argc = tokenize(argv, UART_RxBuffer, " ");
 
-        /* loop through command list and call relevant callback */
+        /* look up command and call relevant callback */
         status.cmd_executed = FALSE;
-        for( int i = 0; i < cmd_list_len; i++)
+        entry = (argc > 0) ? cli_FindCommand(argv[0]) : NULL;
+
+        if(entry != NULL)
         {
-            if(!strcmp(argv[0], cmd_name[i]))
+            status.cmd_executed = TRUE;
+
+            if(argc < pgm_read_byte(&entry->min_argc))
+            {
+                uart_SendString_P(PSTR("Insufficient number of inputs\n\r"));
+            }
+            else
             {
                 /* call the relevant callback */
-                err_no = (cmd_list[i])(argc, argv);
-                status.cmd_executed = TRUE;
+                callback = (CMD_Callback) pgm_read_ptr(&entry->callback);
+                err_no = callback(argc, argv);
 
                 /* report errors */
                 if(err_no != 0)
                 {
-                    uart_SendString("Error:");
+                    uart_SendString_P(PSTR("Error:"));
                     uart_SendInt(err_no);
-                    uart_SendString(" in Cmd:");
-                    uart_SendString(cmd_name[i]);
-                    uart_SendString("\n\r");
+                    uart_SendString_P(PSTR(" in Cmd:"));
+                    uart_SendString_P(pgm_read_ptr(&entry->name));
+                    uart_SendString_P(PSTR("\n\r"));
                 }
-                break;
             }
         }
         /* unknown command */
-        if(status.cmd_executed == FALSE)
+        else if(argc > 0)
         {
             uart_SendString(argv[0]);
-            uart_SendString(": command not found\n\r");
+            uart_SendString_P(PSTR(": command not found\n\r"));
         }
 
         /* reset */
@@ -84,8 +173,22 @@ void cli_ParseCommand(unsigned int cmd_list_len)
 /* behavior after keypress */
 void cli_Keypress()
 {
+    int data;
+    uint16_t key;
+
+    /* leave input queued until the pending command has been parsed */
+    if(status.cmd_check == TRUE) return;
+
     /* copy-in byte */
-    char data = *UART_UDRn;
+    data = uart_GetByte();
+    if(data < 0) return;
+
+    /* arrows, function keys and Alt combinations are swallowed whole
+       instead of leaving '[A' and the like on the line */
+    key = KEY_Feed(data);
+    if(key == KEY_NONE || KEY_MODS(key) != 0 || KEY_CODE(key) >= KEY_UP)
+        return;
+    data = KEY_CODE(key);
 
     /* if command checking flag is off */
     if(status.cmd_check == FALSE)
@@ -104,10 +207,10 @@ void cli_Keypress()
                 UART_RxPtr++;
             }
             /* max size */
-            else uart_SendByte('\b');
+            else uart_StreamSendByte(UART_STREAM_ECHO, '\b');
 
             /* echo the char */
-            uart_SendByte(data);
+            uart_StreamSendByte(UART_STREAM_ECHO, data);
         }
         /* respond only to backspace and enter */
         else
@@ -115,15 +218,16 @@ void cli_Keypress()
             switch(data)
             {
                 /* backspace */
-                case '\b':
-                    uart_SendByte('\b');
-                    uart_SendByte(' ');
-                    uart_SendByte('\b');
+                case KEY_BACKSPACE:
+                case KEY_RUBOUT:
+                    uart_StreamSendByte(UART_STREAM_ECHO, '\b');
+                    uart_StreamSendByte(UART_STREAM_ECHO, ' ');
+                    uart_StreamSendByte(UART_STREAM_ECHO, '\b');
                     if(UART_RxPtr>0) UART_RxPtr--;
                 break;
 
                 /* enter */
-                case 13:
+                case KEY_ENTER:
                     /* finalize by appending '\0' */
                     UART_RxBuffer[UART_RxPtr] = '\0';
                     /* set command execute flag on */
@@ -132,5 +236,4 @@ void cli_Keypress()
             }
         }
     }
-    status.rx_int = FALSE;
 }
\ No newline at end of file
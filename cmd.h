@@ -8,6 +8,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "global.h"
 #include "uart.h"
 
@@ -15,8 +16,57 @@
 /*  Registered commands and callbacks */
 /* ---------------------------------- */
 
-extern char * cmd_name[];
-extern int (*cmd_list[])(uint8_t argc, char ** argv);
+typedef int (*CMD_Callback)(uint8_t argc, char ** argv);
+
+/* one command; the whole table and its strings live in flash */
+typedef struct CMD_ENTRY
+{
+    /* PROGMEM strings */
+    const char * name;
+    const char * args;
+    const char * help;
+
+    CMD_Callback callback;
+
+    /* minimum argc, counting the command name itself */
+    uint8_t min_argc;
+
+} CMD_ENTRY;
+
+#define CMD_MAX_COMMANDS 48
+#define CMD_NAME_MAX 16
+
+extern const CMD_ENTRY cmd_table[] PROGMEM;
+extern const uint8_t cmd_table_len;
+
+/* # Command registration
+
+   Commands are declared once in an X-macro list,
+
+     #define MY_COMMANDS(X) \
+         X(name, callback, min_argc, "args", "help text") \
+         ...
+     CMD_REGISTER(MY_COMMANDS)
+
+   which emits the flash-resident names, help strings and cmd_table[].
+   The list may be in any order; cli_Init() builds a sorted index.
+*/
+#define _CMD_STRINGS(name, cbk, min_argc, args, help) \
+    static const char cmd_name_##name[] PROGMEM = #name; \
+    static const char cmd_args_##name[] PROGMEM = args; \
+    static const char cmd_help_##name[] PROGMEM = help; \
+    typedef char cmd_name_too_long_##name[ \
+        (sizeof(#name) <= CMD_NAME_MAX) ? 1 : -1];
+
+#define _CMD_ENTRY(name, cbk, min_argc, args, help) \
+    {cmd_name_##name, cmd_args_##name, cmd_help_##name, &cbk, min_argc},
+
+#define CMD_REGISTER(LIST) \
+    LIST(_CMD_STRINGS) \
+    const CMD_ENTRY cmd_table[] PROGMEM = { LIST(_CMD_ENTRY) }; \
+    const uint8_t cmd_table_len = sizeof(cmd_table) / sizeof(CMD_ENTRY); \
+    typedef char cmd_table_too_long[ \
+        (sizeof(cmd_table) / sizeof(CMD_ENTRY) <= CMD_MAX_COMMANDS) ? 1 : -1];
 
 /* --------------------------------- */
 /*  Command arguments from terminal  */
@@ -33,8 +83,17 @@ extern uint8_t argc;
 /* tokenize str_buffer for argument passing, str_buffer is modified */
 extern uint8_t tokenize(char **tokens, char *str_buffer, const char* delim);
 
+/* build the sorted command index; call once before parsing */
+extern void cli_Init(void);
+
+/* look up a command by name; NULL if unknown */
+extern const CMD_ENTRY * cli_FindCommand(const char *name);
+
+/* print name, arguments and help of every command */
+extern void cli_PrintHelp(void);
+
 /* for parsing commands in cli context */
-extern void cli_ParseCommand(unsigned int cmd_list_len);
+extern void cli_ParseCommand(void);
 
 /* behavior after keypress */
 extern void cli_Keypress();
@@ -7,9 +7,6 @@
   module and GTKTerm serial program. Configured for 16Mhz and 19.2 kbps.
 
 # TODO:
-- Decrease pre-scalar to get finest decent angular resolution for the MG996R,
-  1.8 deg I believe. 0.9 deg it as the dead-band.
-
 - Encapsulate each timer into its own PWM control class; distinguish the 8-bit and
   16 bit. Use offsets for the pointer locations! OCR[0-3][A-C]-> OCRnX etc.
 
@@ -26,486 +23,890 @@
 #include <util/delay.h> 
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
+#include <avr/pgmspace.h>
 #include "global.h"
 #include "uart.h"
 #include "cmd.h"
 #include "timer.h"
 #include "pwm.h"
+#include "motion.h"
+#include "proto.h"
+#include "sservo.h"
+#include "record.h"
+#include "calib.h"
+#include "macro.h"
+#include "tick.h"
+#include "sched.h"
+#include "key.h"
+#include "keymap.h"
 
 /* ------------- */
 /*  PWM control  */
 /* ------------- */
 
 #define PWM_STEPS 0x007D
-#define PWM_MAX 0x0271
-#define PWM_INC 0x0001
+#define PWM_MAX SERVO_TOP
+/* compare counts per level; 32 us, levels keep their original pulses */
+#define PWM_INC 0x0020
 
 #define PWM_HIGH 72
 #define PWM_LOW 14
 #define PWM_IDLE 50
 #define PWM_STEPS_INT 58
 
-TIMER timer1;
-TIMER timer4;
+/* hardware PWM groups; 3 channels on each 16-bit timer not given to the
+   software servo driver */
+#if SSERVO_TIMER
+#define PWM_GROUPS 3
+#else
+#define PWM_GROUPS 4
+#endif
+
+TIMER timer_grp[PWM_GROUPS];
+PWM pwm_grp[PWM_GROUPS];
+
+#if SSERVO_TIMER
+/* software servo groups, registry channels after the hardware ones */
+PWM sservo_grp[SSERVO_GROUPS];
+
+/* software servo pins; SSERVO_CHANNELS entries [pins 22-29, 37-30, A8-A15] */
+static const SSERVO_PIN sservo_pin[SSERVO_CHANNELS] PROGMEM = {
+    {&PORTA, 1 << 0}, {&PORTA, 1 << 1}, {&PORTA, 1 << 2}, {&PORTA, 1 << 3},
+    {&PORTA, 1 << 4}, {&PORTA, 1 << 5}, {&PORTA, 1 << 6}, {&PORTA, 1 << 7},
+    {&PORTC, 1 << 0}, {&PORTC, 1 << 1}, {&PORTC, 1 << 2}, {&PORTC, 1 << 3},
+    {&PORTC, 1 << 4}, {&PORTC, 1 << 5}, {&PORTC, 1 << 6}, {&PORTC, 1 << 7},
+    {&PORTK, 1 << 0}, {&PORTK, 1 << 1}, {&PORTK, 1 << 2}, {&PORTK, 1 << 3},
+    {&PORTK, 1 << 4}, {&PORTK, 1 << 5}, {&PORTK, 1 << 6}, {&PORTK, 1 << 7}
+};
+#endif
 
-PWM pwm_grp[2];
-volatile uint8_t pwm_select = 0;
-volatile PWM_Channel pwm_chn;
-volatile char pwm_select_char;
+/* selected servo; channel registry index [MOTION_Channel] */
+volatile uint8_t servo_select = 0;
 
 uint8_t slider_pos;
 
-/* -------------- */
-/*  Terminal I/O  */
-/* -------------- */
-char str_buffer[80];
-
-// for short temp strings
-char str_temp[20];
+/* time asleep over the last second [per mille]; sampled by task_Load */
+static uint16_t servo_idle_recent;
 
 /* ---------------------------------- */
 /*  Registered commands and callbacks */
 /* ---------------------------------- */
 
-#define CMD_LIST_LEN 9 // exact fixed number of commands at runtime
-
-char str_help[] = 
-    "\n\r# List of commands\n\r\n\r"
-    "help : Displays this list\n\r"
-    "status : output current PWM level \n\r"
-    "inc : increase PWM level by one unit \n\r"
-    "dec : decrease PWM level by one unit \n\r"
-    "idle : set PWM level to idle \n\r"
-    "mode : change mode to 'manual' \n\r"
-    "select: change PWM channel to 'A,B,C' \n\r"
-    "frequency : Displays the pwm frequency in Hz\n\r"
-    "duty_cycle : Displays the duty cycle of currently selected channel\n\r"
-    "\n\r";
-
-char *cmd_name[CMD_LIST_LEN] = {
-    "help", "status", "inc", "dec", "idle", "mode", "select", "frequency", "duty_cycle"
-};
+/* # PWM group and channel of the selected servo */
+static PWM * servo_Selected(PWM_Channel *chn_x)
+{
+    return MOTION_Channel(servo_select, chn_x);
+}
 
 int cbk_help(uint8_t argc, char **argv)
 {
-    uart_SendString(str_help);
+    cli_PrintHelp();
     return 0;
 }
 
 int cbk_print_pwm_level(uint8_t argc, char **argv)
 {
-    sprintf(
-        str_buffer,
-        "PWM Level / Inc: %d / %d  LOW / IDLE / HIGH: %d / %d / %d  "
-        "PWM Select: %c%d \n\r",
-        pwm_grp[pwm_select].pwm_level[pwm_chn],
-        pwm_grp[pwm_select].pwm_step[pwm_chn],
-        pwm_grp[pwm_select].pwm_level_min[pwm_chn],
-        pwm_grp[pwm_select].pwm_level_idle[pwm_chn],
-        pwm_grp[pwm_select].pwm_level_max[pwm_chn],
-        pwm_select_char,
-        pwm_select
-    );
-    uart_SendString(str_buffer);
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
+
+    uart_SendString_P(PSTR("PWM Level / Inc: "));
+    uart_SendUInt(pwm->pwm_level[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_step[pwm_chn]);
+    uart_SendString_P(PSTR("  LOW / IDLE / HIGH: "));
+    uart_SendUInt(pwm->pwm_level_min[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_level_idle[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_level_max[pwm_chn]);
+    uart_SendString_P(PSTR("  Channel: "));
+    uart_SendUInt(servo_select);
+    uart_SendString_P(PSTR(" ["));
+    uart_SendByte('A' + pwm_chn);
+    uart_SendUInt(servo_select / 3);
+    uart_SendByte(']');
+    if(MOTION_Busy())
+        uart_SendString_P(PSTR("  moving"));
+    uart_SendString_P(PSTR(" \n\r"));
     return 0;
 }
 
 int cbk_inc_pwm_level(uint8_t argc, char **argv)
 {
-    return PWM_Inc(&pwm_grp[pwm_select], pwm_chn);
+    return MOTION_Inc(servo_select);
 }
 
 int cbk_dec_pwm_level(uint8_t argc, char **argv)
 {
-    return PWM_Dec(&pwm_grp[pwm_select], pwm_chn);
+    return MOTION_Dec(servo_select);
 }
 
 int cbk_idle_pwm_level(uint8_t argc, char **argv)
 {
-    return PWM_Idle(&pwm_grp[pwm_select], pwm_chn);
+    return MOTION_Idle(servo_select);
 }
 
 int cbk_mode(uint8_t argc, char **argv)
 {
-    if(argc < 2)
-    {
-        uart_SendString("Insufficient number of inputs\n\r");
-        return 0;
-    }
-    
     if(strcmp(argv[1], "manual") == 0)
     {
         uint8_t i;
+        PWM_Channel pwm_chn;
+        PWM *pwm = servo_Selected(&pwm_chn);
 
         /* change context */
         context = context_manual;
+        KEY_Reset();
 
-        uart_SendString(
+        uart_SendString_P(PSTR(
             "\n\r[MANUAL MODE]"
             " use up and down keys to change angle; enter to exit\n\r"
-        );
+        ));
 
         for (i = 0; i < PWM_STEPS_INT + 2; i++) uart_SendByte(' ');
         uart_SendByte(']');
-        uart_SendString("\r[");
-        for (i = 0; i < pwm_grp[pwm_select].pwm_level[pwm_chn] - PWM_LOW; i++) uart_SendByte('=');
-        slider_pos = pwm_grp[pwm_select].pwm_level[pwm_chn] - PWM_LOW;
+        uart_SendString_P(PSTR("\r["));
+        for (i = 0; i < pwm->pwm_level[pwm_chn] - PWM_LOW; i++) uart_SendByte('=');
+        slider_pos = pwm->pwm_level[pwm_chn] - PWM_LOW;
     }
     else if(strcmp(argv[1], "game") == 0)
     {
         /* change context */
         context = context_game;
+        KEY_Reset();
 
-        uart_SendString(
+        uart_SendString_P(PSTR(
             "\n\r[GAME MODE]"
             " up/down [channel A], left/right [channel B], "
             " W/S [channel C]; enter to exit\n\r"
-        );
+        ));
 
     }
-    else uart_SendString("Unknown mode\n\r");
+    else uart_SendString_P(PSTR("Unknown mode\n\r"));
     return 0;
 }
 
+/* # Select a servo by channel number, or A|B|C within its group */
 int cbk_select(uint8_t argc, char **argv)
 {
-    if(argc < 2)
+    long ch;
+
+    if(argv[1][0] >= 'A' && argv[1][0] <= 'C' && argv[1][1] == '\0')
+        ch = servo_select - servo_select % 3 + (argv[1][0] - 'A');
+    else if(argv[1][0] >= '0' && argv[1][0] <= '9')
+        ch = strtol(argv[1], NULL, 10);
+    else
+        ch = -1;
+
+    if(ch < 0 || ch >= MOTION_Channels())
     {
-        uart_SendString("Insufficient number of inputs\n\r");
+        uart_SendString_P(PSTR("Unknown channel\n\r"));
+        return 0;
     }
-    else if(strcmp(argv[1], "A") == 0)
+
+    servo_select = ch;
+    uart_SendString_P(PSTR("Channel "));
+    uart_SendUInt(ch);
+    uart_SendString_P(PSTR(" selected\n\r"));
+    return 0;
+}
+
+int cbk_pwm_frequency(uint8_t argc, char **argv)
+{
+    PWM_Channel pwm_chn;
+
+    uart_SendString_P(PSTR("PWM Frequency: "));
+    uart_SendFixed(PWM_FrequencyHz(servo_Selected(&pwm_chn)), 8, 2);
+    uart_SendString_P(PSTR(" Hz\n\r"));
+    return 0;
+}
+
+int cbk_duty_cycle(uint8_t argc, char **argv)
+{
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
+
+    uart_SendString_P(PSTR("Duty Cycle: "));
+    uart_SendFixed(PWM_DutyCycle(pwm, pwm_chn), 8, 2);
+    uart_SendString_P(PSTR(" %\n\r"));
+    return 0;
+}
+
+int cbk_pulse(uint8_t argc, char **argv)
+{
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
+    uint16_t lo, hi;
+    long us;
+
+    if(argc == 2)
     {
-        pwm_select_char = 'A';
-        pwm_chn = chn_A;
-        uart_SendString("Channel A selected\n\r");
+        /* the pulses of the channel's min and max levels */
+        lo = PWM_LevelUs(pwm, pwm_chn, pwm->pwm_level_min[pwm_chn]);
+        hi = PWM_LevelUs(pwm, pwm_chn, pwm->pwm_level_max[pwm_chn]);
+        us = strtol(argv[1], NULL, 10);
+        if(us < lo || us > hi)
+        {
+            uart_SendString_P(PSTR("Rejected: pulse must be "));
+            uart_SendUInt(lo);
+            uart_SendString_P(PSTR(".."));
+            uart_SendUInt(hi);
+            uart_SendString_P(PSTR(" us\n\r"));
+            return 0;
+        }
+        PWM_SetPulseUs(pwm, pwm_chn, us);
     }
-    else if(strcmp(argv[1], "B") == 0)
+
+    uart_SendString_P(PSTR("Pulse: "));
+    uart_SendUInt(PWM_PulseUs(pwm, pwm_chn));
+    uart_SendString_P(PSTR(" us\n\r"));
+    return 0;
+}
+
+int cbk_rx_stat(uint8_t argc, char **argv)
+{
+    uart_SendString_P(PSTR("RX ring overrun / data overrun / frame error: "));
+    uart_SendUInt(uart_console->rx_count.ring_overrun);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(uart_console->rx_count.data_overrun);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(uart_console->rx_count.frame_error);
+    uart_SendString_P(PSTR("\n\r"));
+
+    uart_SendString_P(PSTR("Binary frames / CRC error / length error: "));
+    uart_SendUInt(proto_count.frames);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(proto_count.crc_errors);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(proto_count.length_errors);
+    uart_SendString_P(PSTR("\n\r"));
+    return 0;
+}
+int cbk_profile(uint8_t argc, char **argv)
+{
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
+    long vel, acc, jerk;
+
+    if(argc >= 3)
     {
-        pwm_select_char = 'B';
-        pwm_chn = chn_B;
-        uart_SendString("Channel B selected\n\r");
+        /* velocity state is a signed 8.8 value */
+        vel = atol(argv[1]);
+        acc = atol(argv[2]);
+        jerk = (argc >= 4) ? atol(argv[3]) : 0;
+        if(vel < 1 || vel > INT16_MAX || acc < 0 || acc > 0xFFFF ||
+           jerk < 0 || jerk > 0xFFFF)
+        {
+            uart_SendString_P(PSTR("vel 1..32767, acc / jerk 0..65535\n\r"));
+            return 0;
+        }
+
+        PWM_ProfileConfig(pwm, pwm_chn, vel, acc, jerk);
     }
-    else if(strcmp(argv[1], "C") == 0)
+    else if(argc == 2)
     {
-        pwm_select_char = 'C';
-        pwm_chn = chn_C;
-        uart_SendString("Channel C selected\n\r");
+        uart_SendString_P(PSTR("Usage: profile vel acc [jerk]\n\r"));
+        return 0;
     }
-    else if(strcmp(argv[1], "0") == 0)
+
+    uart_SendString_P(PSTR("Vel / Acc / Jerk: "));
+    uart_SendUInt(pwm->pwm_vel_max[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_acc_max[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_jerk_max[pwm_chn]);
+    uart_SendString_P(PSTR("\n\r"));
+    return 0;
+}
+
+int cbk_move(uint8_t argc, char **argv)
+{
+    uint16_t levels[MOTION_MAX_CHANNELS];
+    uint8_t mask[MOTION_MASK_BYTES] = {0};
+    PWM_Channel pwm_chn;
+    PWM *pwm;
+    long ch, level;
+    uint8_t i;
+
+    if(argc < 3 || !(argc & 1))
     {
-        pwm_select = 0;
-        uart_SendString("PWM Group 0 selected\n\r");
+        uart_SendString_P(PSTR("Usage: move ch level [ch level ...]\n\r"));
+        return 0;
     }
-    else if(strcmp(argv[1], "1") == 0)
+
+    for(i = 1; i < argc; i += 2)
     {
-        pwm_select = 1;
-        uart_SendString("PWM Group 1 selected\n\r");
+        ch = strtol(argv[i], NULL, 10);
+        if(ch < 0 || ch >= MOTION_Channels())
+        {
+            uart_SendString_P(PSTR("Unknown channel\n\r"));
+            return 0;
+        }
+
+        /* within the channel's limits; nothing moves otherwise */
+        pwm = MOTION_Channel(ch, &pwm_chn);
+        level = strtol(argv[i + 1], NULL, 10);
+        if(level < pwm->pwm_level_min[pwm_chn] ||
+           level > pwm->pwm_level_max[pwm_chn])
+        {
+            uart_SendString_P(PSTR("Level out of range\n\r"));
+            return 0;
+        }
+
+        levels[ch] = level;
+        MOTION_MASK_SET(mask, ch);
     }
-    else uart_SendString("Unknown channel / group\n\r");
 
-    return 0;
+    return MOTION_Move(mask, levels);
 }
 
-int cbk_pwm_frequency(uint8_t argc, char **argv)
+int cbk_binary(uint8_t argc, char **argv)
 {
-    // The calculation is completely off. Need to finx in pwm.c
-    PWM_FrequencyHz(&pwm_grp[pwm_select], str_temp);
-    sprintf(str_buffer,"PWM Frequency: %s\n\r",str_temp);
-    uart_SendString(str_buffer);
-    return 0;
-}
+    UART *port = uart_console;
+    long id;
 
-int cbk_duty_cycle(uint8_t argc, char **argv)
-{
-    // The calculation is completely off. Need to finx in pwm.c
-    PWM_DutyCycle(&pwm_grp[pwm_select], pwm_chn, str_temp);
-    sprintf(str_buffer,"Duty Cycle: %s\n\r",str_temp);
-    uart_SendString(str_buffer);
+    if(argc >= 2)
+    {
+        id = strtol(argv[1], NULL, 10);
+        port = (id >= 0 && id <= 3) ? UART_Port(id) : NULL;
+        if(port == NULL)
+        {
+            uart_SendString_P(PSTR("Port not built\n\r"));
+            return 0;
+        }
+    }
+
+    if(port != uart_console)
+    {
+        /* link port; the CLI stays on the console */
+        UART_FlushRxRing(port);
+        PROTO_Init(port);
+        uart_SendString_P(PSTR("Binary protocol on port "));
+        uart_SendUInt(port->id);
+        uart_SendString_P(PSTR("\n\r"));
+        return 0;
+    }
+
+    uart_SendString_P(PSTR("[BINARY MODE] send EXIT frame to leave\n\r"));
+
+    /* change context */
+    PROTO_Init(port);
+    context = context_binary;
     return 0;
 }
 
+static const char str_stream_names[UART_N_STREAMS][10] PROGMEM = {
+    "reply", "echo"
+};
 
-int (*cmd_list[CMD_LIST_LEN])(uint8_t, char **) = {
-    &cbk_help,
-    &cbk_print_pwm_level, &cbk_inc_pwm_level, &cbk_dec_pwm_level,
-    &cbk_idle_pwm_level,
-    &cbk_mode, &cbk_select, &cbk_pwm_frequency, &cbk_duty_cycle
+static const char str_policy_names[3][10] PROGMEM = {
+    "block", "drop", "overwrite"
 };
 
-/* --------------------------- */
-/*  Manual mode event handler  */
-/* --------------------------- */
-void manual_Keypress()
+int cbk_tx_policy(uint8_t argc, char **argv)
 {
-    /* copy-in byte */
-    char data = *UART_UDRn;
+    uint8_t stream, policy;
 
-    switch(data)
+    if(argc >= 3)
     {
-        /* escape character */
-        case '\x1b':
-            status.esc_char = TRUE;
-        break;
+        for(stream = 0; stream < UART_N_STREAMS; stream++)
+            if(!strcmp_P(argv[1], str_stream_names[stream])) break;
+        for(policy = 0; policy < 3; policy++)
+            if(!strcmp_P(argv[2], str_policy_names[policy])) break;
 
-        case '[':
-            status.bracket = (status.esc_char == TRUE) ? TRUE : FALSE; 
-            status.esc_char = FALSE;
-        break;
+        if(stream == UART_N_STREAMS || policy == 3)
+        {
+            uart_SendString_P(PSTR("Unknown stream / policy\n\r"));
+            return 0;
+        }
+        uart_SetTxPolicy(stream, policy);
+    }
 
-        /* up key */
-        case 'A':
-            if(status.bracket)
-            {
-                status.bracket = FALSE;
-                if((slider_pos < PWM_STEPS_INT) &&
-                    (pwm_grp[pwm_select].pwm_level[pwm_chn] < pwm_grp[pwm_select].pwm_level_max[pwm_chn])
-                  )
-                {
-                    PWM_Inc(&pwm_grp[pwm_select], pwm_chn);
-                    uart_SendByte('=');
-                    slider_pos++;
-                }
-            }
-        break;
+    for(stream = 0; stream < UART_N_STREAMS; stream++)
+    {
+        uart_SendString_P(str_stream_names[stream]);
+        uart_SendString_P(PSTR(": "));
+        uart_SendString_P(str_policy_names[uart_GetTxPolicy(stream)]);
+        uart_SendString_P(PSTR(", dropped "));
+        uart_SendUInt(uart_console->tx_dropped[stream]);
+        uart_SendString_P(PSTR("\n\r"));
+    }
+    return 0;
+}
 
-        /* down key */
-        case 'B':
-            if(status.bracket)
-            {
-                status.bracket = FALSE;
-                if((slider_pos > 0) && 
-                    (pwm_grp[pwm_select].pwm_level[pwm_chn] > pwm_grp[pwm_select].pwm_level_min[pwm_chn])
-                )
-                {
-                    PWM_Dec(&pwm_grp[pwm_select], pwm_chn);
-                    uart_SendByte('\b');
-                    uart_SendByte(' ');
-                    uart_SendByte('\b');
-                    slider_pos--;
-                }
-            }
-        break;
+int cbk_baud(uint8_t argc, char **argv)
+{
+    uint32_t baud;
+    int16_t err;
+    uint8_t i;
 
-        /* enter key */
-        case 13:
-            context = context_cli;
-            status.esc_char = FALSE;
-            status.bracket = FALSE;
-            uart_SendString("\n\r");
-            uart_FlushRxBuffer();
-        break;
+    if(argc >= 2)
+    {
+        baud = strtoul(argv[1], NULL, 10);
+        for(i = 0; i < uart_BaudTableLen(); i++)
+            if(uart_BaudTableRate(i) == baud) break;
 
-        default:
-        break;
+        if(i == uart_BaudTableLen())
+        {
+            uart_SendString_P(PSTR("Unsupported rate\n\r"));
+        }
+        else
+        {
+            /* the reply goes out at the old rate before switching */
+            uart_SendString_P(PSTR("Switching to "));
+            uart_SendULong(baud);
+            uart_SendString_P(PSTR(" baud\n\r"));
+            uart_SetBaud(baud);
+        }
     }
 
-    status.rx_int = FALSE;
+    uart_SendString_P(PSTR("Baud: "));
+    uart_SendULong(uart_GetBaud());
+    uart_SendString_P(PSTR("  Error: "));
+    err = uart_BaudError();
+    if(err < 0)
+    {
+        uart_SendByte('-');
+        err = -err;
+    }
+    uart_SendUInt(err / 10);
+    uart_SendByte('.');
+    uart_SendByte('0' + err % 10);
+    uart_SendString_P(PSTR(" %\n\rRates:"));
+    for(i = 0; i < uart_BaudTableLen(); i++)
+    {
+        uart_SendByte(' ');
+        uart_SendULong(uart_BaudTableRate(i));
+    }
+    uart_SendString_P(PSTR("\n\r"));
+    return 0;
 }
 
-/* --------------------------- */
-/*  Game mode event handler    */
-/* --------------------------- */
-void game_Keypress()
+int cbk_record(uint8_t argc, char **argv)
 {
-    /* copy-in byte */
-    char data = *UART_UDRn;
+    uint32_t percent = 100;
+    char *end;
 
-    switch(data)
+    if(argc >= 2)
     {
-        /* escape character */
-        case '\x1b':
-            status.esc_char = TRUE;
-        break;
-
-        case '[':
-            status.bracket = (status.esc_char == TRUE) ? TRUE : FALSE; 
-            status.esc_char = FALSE;
-        break;
+        if(strcmp(argv[1], "start") == 0)
+            RECORD_Start();
+        else if(strcmp(argv[1], "stop") == 0)
+            RECORD_Stop();
+        else if(strcmp(argv[1], "play") == 0)
+        {
+            if(argc >= 3)
+            {
+                /* rate is 8.8 in 16 bits: up to 255.99x */
+                percent = strtoul(argv[2], &end, 10);
+                if(argv[2][0] == '-' || *end != '\0' ||
+                   percent < 1 || percent > 25599)
+                {
+                    uart_SendString_P(PSTR("Usage: record play [1..25599 percent]\n\r"));
+                    return 0;
+                }
+            }
+            if(RECORD_Play((percent * RECORD_RATE_1X) / 100) < 0)
+                uart_SendString_P(PSTR("Nothing to play\n\r"));
+        }
+        else
+        {
+            uart_SendString_P(PSTR("Usage: record [start|stop|play [percent]]\n\r"));
+            return 0;
+        }
+    }
 
-        /* --- Channel A0 / B1-- */
+    uart_SendString_P(PSTR("Recorder: "));
+    switch(RECORD_GetState())
+    {
+        case record_capture: uart_SendString_P(PSTR("recording")); break;
+        case record_seek: uart_SendString_P(PSTR("moving to start")); break;
+        case record_play: uart_SendString_P(PSTR("playing")); break;
+        default: uart_SendString_P(PSTR("idle")); break;
+    }
+    uart_SendString_P(PSTR("  Bytes: "));
+    uart_SendUInt(RECORD_Length());
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(RECORD_SIZE);
+    uart_SendString_P(PSTR("  Frames: "));
+    uart_SendULong(RECORD_Frames());
+    uart_SendString_P(PSTR("\n\r"));
+    return 0;
+}
 
-        /* right key */
-        case 'C':
-            if(status.bracket)
+int cbk_cal(uint8_t argc, char **argv)
+{
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
+    uint16_t config[4];
+    unsigned long value;
+    char *end;
+    uint8_t i;
+
+    config[0] = pwm->pwm_level_max[pwm_chn];
+    config[1] = pwm->pwm_level_min[pwm_chn];
+    config[2] = pwm->pwm_level_idle[pwm_chn];
+    config[3] = pwm->pwm_step[pwm_chn];
+
+    if(argc == 2 && strcmp(argv[1], "save") == 0)
+    {
+        CALIB_Save();
+        uart_SendString_P(PSTR("Saved\n\r"));
+        return 0;
+    }
+    else if(argc == 2 && strcmp(argv[1], "reset") == 0)
+    {
+        CALIB_Erase();
+        uart_SendString_P(PSTR("Defaults after reset\n\r"));
+        return 0;
+    }
+    else if(argc == 3)
+    {
+        /* field in PWM_PwmConfig order */
+        if(strcmp(argv[1], "max") == 0) i = 0;
+        else if(strcmp(argv[1], "min") == 0) i = 1;
+        else if(strcmp(argv[1], "idle") == 0) i = 2;
+        else if(strcmp(argv[1], "step") == 0) i = 3;
+        else i = 4;
+
+        if(i < 4)
+        {
+            value = strtoul(argv[2], &end, 10);
+            if(argv[2][0] == '-' || end == argv[2] || *end != '\0' ||
+               value > 0xFFFF)
             {
-                PWM_Inc(&pwm_grp[0], chn_A);
-                status.bracket = FALSE;
+                uart_SendString_P(PSTR("Value must be 0..65535\n\r"));
+                return 0;
             }
-        break;
 
-        case 'D':
-            /* left key */
-            if(status.bracket)
-            {
-                PWM_Dec(&pwm_grp[0], chn_A);
-                status.bracket = FALSE;
-            } else
-            /* D key */
+            config[i] = value;
+            if(PWM_SetLimits(pwm, config, pwm_chn))
             {
-                PWM_Dec(&pwm_grp[1], chn_B);
+                uart_SendString_P(PSTR(
+                    "Rejected: needs min <= idle <= max, step > 0 "
+                    "and max * step <= TOP\n\r"));
+                return 0;
             }
+        }
+    }
 
-        break;
+    if((argc == 3 && i == 4) || argc == 2)
+    {
+        uart_SendString_P(PSTR("Usage: cal [max|min|idle|step n | save | reset]\n\r"));
+        return 0;
+    }
 
-        /* --- Channel B0 /B1-- */
+    uart_SendString_P(PSTR("Max / Min / Idle / Step: "));
+    uart_SendUInt(pwm->pwm_level_max[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_level_min[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_level_idle[pwm_chn]);
+    uart_SendString_P(PSTR(" / "));
+    uart_SendUInt(pwm->pwm_step[pwm_chn]);
+    uart_SendString_P(PSTR("\n\r"));
+    return 0;
+}
 
-        case 'A':
-            /* up key */
-            if(status.bracket)
-            {
-                PWM_Inc(&pwm_grp[0], chn_B);
-                status.bracket = FALSE;
-            } else 
-            /* A key */
-            {
-                PWM_Inc(&pwm_grp[1], chn_B);
-            }
-        break;
+int cbk_power(uint8_t argc, char **argv)
+{
+    uint32_t up = TICK_Ms();
+    uint32_t asleep = TICK_SleepMs();
+
+    uart_SendString_P(PSTR("Uptime: "));
+    uart_SendULong(up);
+    uart_SendString_P(PSTR(" ms  Asleep: "));
+    uart_SendULong(asleep);
+    uart_SendString_P(PSTR(" ms  Wakeups: "));
+    uart_SendULong(TICK_Wakeups());
+
+    /* per mille asleep; scaled down so the product fits 32 bits */
+    while(up > 0x400000UL)
+    {
+        up >>= 1;
+        asleep >>= 1;
+    }
+    uart_SendString_P(PSTR("\n\rIdle: "));
+    uart_SendFixed(up ? ((asleep * 1000) / up << 8) / 10 : 0, 8, 1);
+    uart_SendString_P(PSTR(" %, last second "));
+    uart_SendFixed(((uint32_t) servo_idle_recent << 8) / 10, 8, 1);
+    uart_SendString_P(PSTR(" %\n\r"));
+    return 0;
+}
 
-        /* down key */
-        case 'B':
-            if(status.bracket)
-            {
-                PWM_Dec(&pwm_grp[0], chn_B);
-                status.bracket = FALSE;
-            }
-        break;
+int cbk_tasks(uint8_t argc, char **argv)
+{
+    SCHED_List();
+    return 0;
+}
 
-        /* --- Channel C0 -- */
+/* longest step delay [ms]; MACRO_DELAY_MAX frames */
+#define MACRO_DELAY_MAX_MS (MACRO_DELAY_MAX * MOTION_FRAME_US / 1000)
 
-        /* W key */
-        case 'W':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[0], chn_C);
-            }
-        break;
+int cbk_macro(uint8_t argc, char **argv)
+{
+    unsigned long ms;
+    long repeat, times;
+    int err = 0;
 
-        /* S key */
-        case 'S':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[0], chn_C);
-            }
-        break;
+    if(argc >= 6 && strcmp(argv[1], "add") == 0)
+    {
+        repeat = strtol(argv[3], NULL, 10);
+        ms = strtoul(argv[4], NULL, 10);
+        if(repeat < 0 || repeat > 255 || argv[4][0] == '-' ||
+           ms > MACRO_DELAY_MAX_MS)
+        {
+            uart_SendString_P(PSTR("repeat 0..255, ms 0.."));
+            uart_SendULong(MACRO_DELAY_MAX_MS);
+            uart_SendString_P(PSTR("\n\r"));
+            return 0;
+        }
 
-        /* w key */
-        case 'w':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[0], chn_C);
-            }
-        break;
+        /* delay rounded to whole frames */
+        err = MACRO_Add(argv[2], repeat,
+                        (ms * 1000 + MOTION_FRAME_US / 2) / MOTION_FRAME_US,
+                        argc - 5, &argv[5]);
+    }
+    else if(argc >= 3 && strcmp(argv[1], "run") == 0)
+    {
+        times = (argc >= 4) ? strtol(argv[3], NULL, 10) : 1;
+        if(times < 0 || times > 255)
+        {
+            uart_SendString_P(PSTR("times 0..255 [0 until stopped]\n\r"));
+            return 0;
+        }
+        err = MACRO_Run(argv[2], times);
+    }
+    else if(argc == 3 && strcmp(argv[1], "del") == 0)
+        err = MACRO_Delete(argv[2]);
+    else if(argc == 2 && strcmp(argv[1], "stop") == 0)
+        MACRO_Stop();
+    else if(argc == 2 && strcmp(argv[1], "save") == 0)
+        MACRO_Save();
+    else if(argc == 1)
+        MACRO_List();
+    else
+        uart_SendString_P(PSTR("Usage: macro [add name repeat ms cmd [args] | "
+                               "run name [times] | del name | stop | save]\n\r"));
+    return err;
+}
 
-        /* s key */
-        case 's':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[0], chn_C);
-            }
-        break;
+int cbk_bind(uint8_t argc, char **argv)
+{
+    uint8_t code = (argc >= 2) ? KEY_FromName(argv[1]) : KEY_NONE;
+    long ch, delta;
 
-        /* --- Channel A1 -- */
+    if(argc == 4 && code != KEY_NONE && code != KEY_ENTER)
+    {
+        ch = strtol(argv[2], NULL, 10);
+        delta = strtol(argv[3], NULL, 10);
+        if(ch < 0 || ch >= MOTION_Channels() || delta < -127 || delta > 127)
+        {
+            uart_SendString_P(PSTR("Unknown channel / delta out of range\n\r"));
+            return 0;
+        }
+        KEYMAP_Bind(code, ch, delta);
+    }
+    else if(argc == 2 && strcmp(argv[1], "reset") == 0)
+        KEYMAP_Reset();
+    else if(argc == 2 && strcmp(argv[1], "save") == 0)
+        KEYMAP_Save();
+    else if(argc == 1)
+        KEYMAP_List();
+    else
+        uart_SendString_P(PSTR("Usage: bind [key ch delta | reset | save]\n\r"));
+    return 0;
+}
 
-        /* F key */
-        case 'F':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[1], chn_A);
-            }
-        break;
+/* name, callback, min argc, arguments, help */
+#define COMMANDS(X) \
+    X(help, cbk_help, 1, "", "Displays this list") \
+    X(status, cbk_print_pwm_level, 1, "", "output current PWM level") \
+    X(inc, cbk_inc_pwm_level, 1, "", "increase PWM level by one unit") \
+    X(dec, cbk_dec_pwm_level, 1, "", "decrease PWM level by one unit") \
+    X(idle, cbk_idle_pwm_level, 1, "", \
+        "ramp PWM level back to idle in the background") \
+    X(mode, cbk_mode, 2, "manual|game", "change input mode") \
+    X(select, cbk_select, 2, "ch|A|B|C", \
+        "select servo channel, or A|B|C within its group") \
+    X(frequency, cbk_pwm_frequency, 1, "", "Displays the pwm frequency in Hz") \
+    X(duty_cycle, cbk_duty_cycle, 1, "", \
+        "Displays the duty cycle of currently selected channel") \
+    X(pulse, cbk_pulse, 1, "[us]", \
+        "show or set the pulse width in microseconds") \
+    X(rxstat, cbk_rx_stat, 1, "", \
+        "Displays the uart RX and binary frame error counters") \
+    X(profile, cbk_profile, 1, "[vel acc [jerk]]", \
+        "show / set motion limits of selected channel" \
+        " (8.8 counts per frame)") \
+    X(move, cbk_move, 3, "ch level [ch level ...]", \
+        "move channels together, arriving on the same frame") \
+    X(binary, cbk_binary, 1, "[port]", \
+        "framed binary protocol; on the console until an EXIT frame, " \
+        "or on USART <port> next to the CLI") \
+    X(txpolicy, cbk_tx_policy, 1, "[reply|echo block|drop|overwrite]", \
+        "show / set TX backpressure policy and dropped byte counts") \
+    X(baud, cbk_baud, 1, "[rate]", \
+        "show / switch the uart baud rate, up to 1000000") \
+    X(record, cbk_record, 1, "[start|stop|play [percent]]", \
+        "record inc/dec steps to EEPROM / play them back") \
+    X(cal, cbk_cal, 1, "[max|min|idle|step n | save | reset]", \
+        "show / edit limits of selected channel; save them to EEPROM") \
+    X(power, cbk_power, 1, "", \
+        "uptime, time asleep and wakeups of the idle loop") \
+    X(tasks, cbk_tasks, 1, "", \
+        "list scheduler tasks with runs, overruns and longest run") \
+    X(macro, cbk_macro, 1, \
+        "[add name repeat ms cmd [args] | run name [times] | del name | stop | save]", \
+        "list / edit / run on-device command sequences") \
+    X(bind, cbk_bind, 1, "[key ch delta | reset | save]", \
+        "list / remap game mode keys [a, up, f5, 0x41 ...]; delta 0 unbinds")
+
+CMD_REGISTER(COMMANDS)
+
+/* ------------------------- */
+/*  Per-frame key coalescing */
+/* ------------------------- */
+
+/* net levels asked for by keys since the last frame, per channel */
+static int8_t servo_net[MOTION_MAX_CHANNELS];
+static uint8_t servo_net_pending;
+
+/* # Add delta levels to channel ch for the next frame */
+static void servo_Nudge(uint8_t ch, int16_t delta)
+{
+    if(ch >= MOTION_MAX_CHANNELS) return;
 
-        /* R key */
-        case 'R':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[1], chn_A);
-            }
-        break;
+    delta += servo_net[ch];
+    if(delta > 127) delta = 127;
+    if(delta < -127) delta = -127;
+    servo_net[ch] = delta;
+    servo_net_pending = TRUE;
+}
 
-        /* r key */
-        case 'r':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[1], chn_A);
-            }
-        break;
+/* # Net delta of the selected channel in manual mode
 
-        /* f key */
-        case 'f':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[1], chn_A);
-            }
-        break;
+   Bounded by the slider as well as the channel limits; the slider is
+   redrawn once for the whole delta.
+*/
+static void manual_Apply(int8_t delta)
+{
+    PWM_Channel pwm_chn;
+    PWM *pwm = servo_Selected(&pwm_chn);
 
-        /* --- Channel B1 -- */
+    for(; delta > 0; delta--)
+    {
+        if(slider_pos >= PWM_STEPS_INT ||
+           pwm->pwm_level[pwm_chn] >= pwm->pwm_level_max[pwm_chn]) break;
 
-        /* a key */
-        case 'a':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[1], chn_B);
-            }
-        break;
+        MOTION_Inc(servo_select);
+        uart_StreamSendByte(UART_STREAM_ECHO, '=');
+        slider_pos++;
+    }
 
-        /* d key */
-        case 'd':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[1], chn_B);
-            }
-        break;
+    for(; delta < 0; delta++)
+    {
+        if(slider_pos == 0 ||
+           pwm->pwm_level[pwm_chn] <= pwm->pwm_level_min[pwm_chn]) break;
+
+        MOTION_Dec(servo_select);
+        uart_StreamSendByte(UART_STREAM_ECHO, '\b');
+        uart_StreamSendByte(UART_STREAM_ECHO, ' ');
+        uart_StreamSendByte(UART_STREAM_ECHO, '\b');
+        slider_pos--;
+    }
+}
 
-        /* --- Channel C1 -- */
+/* # Apply the net key deltas once per frame
 
-        /* > key */
-        case '>':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[1], chn_C);
-            }
-        break;
+   However many key bytes arrived during the frame, each channel moves
+   once by their sum, so the servo follows the operator at frame rate
+   instead of working through a backlog of keystrokes.
+*/
+void task_Keys()
+{
+    uint8_t ch;
+    int8_t delta;
 
-        /* < key */
-        case '<':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[1], chn_C);
-            }
-        break;
+    if(!servo_net_pending) return;
+    servo_net_pending = FALSE;
 
-        /* . key */
-        case '.':
-            if(!status.bracket)
-            {
-                PWM_Inc(&pwm_grp[1], chn_C);
-            }
+    for(ch = 0; ch < MOTION_MAX_CHANNELS; ch++)
+    {
+        delta = servo_net[ch];
+        if(delta == 0) continue;
+        servo_net[ch] = 0;
+
+        if(context == context_manual && ch == servo_select)
+            manual_Apply(delta);
+        else
+            MOTION_Step(ch, delta);
+    }
+}
+
+/* --------------------------- */
+/*  Manual mode event handler  */
+/* --------------------------- */
+void manual_Keypress()
+{
+    uint16_t key;
+
+    /* copy-in byte */
+    int data = uart_GetByte();
+    if(data < 0) return;
+
+    key = KEY_Feed(data);
+    switch(KEY_CODE(key))
+    {
+        /* up / down key; applied on the next frame */
+        case KEY_UP:
+            servo_Nudge(servo_select, KEY_Accel(key));
         break;
 
-        /* , key */
-        case ',':
-            if(!status.bracket)
-            {
-                PWM_Dec(&pwm_grp[1], chn_C);
-            }
+        case KEY_DOWN:
+            servo_Nudge(servo_select, -KEY_Accel(key));
         break;
 
         /* enter key */
-        case 13:
+        case KEY_ENTER:
             context = context_cli;
-            status.esc_char = FALSE;
-            status.bracket = FALSE;
-            uart_SendString("Exit game mode\n\r");
+            uart_SendString_P(PSTR("\n\r"));
             uart_FlushRxBuffer();
         break;
 
         default:
         break;
     }
+}
+
+/* --------------------------- */
+/*  Game mode event handler    */
+/* --------------------------- */
+void game_Keypress()
+{
+    KEYMAP_ENTRY act;
+    uint16_t key;
+
+    /* copy-in byte */
+    int data = uart_GetByte();
+    if(data < 0) return;
 
-    status.rx_int = FALSE;
+    key = KEY_Feed(data);
+
+    /* enter key */
+    if(KEY_CODE(key) == KEY_ENTER)
+    {
+        context = context_cli;
+        uart_SendString_P(PSTR("Exit game mode\n\r"));
+        uart_FlushRxBuffer();
+    }
+    else
+    {
+        /* bound keys; one lookup, delta 0 for the rest */
+        act = keymap[KEY_CODE(key)];
+        if(act.delta != 0)
+            servo_Nudge(act.ch, act.delta * KEY_Accel(key));
+    }
 }
 
 /* ---------------- */
@@ -514,50 +915,114 @@ void game_Keypress()
 
 void InitUART()
 {
-    /* uart */
+    UART *port;
+    uint8_t id;
+
+    /* uart; console first, then every other built port */
     uart_Init(1);
+    for(id = 0; id < 4; id++)
+    {
+        port = UART_Port(id);
+        if(port != NULL && port != uart_console) UART_Init(port);
+    }
     sei();
 
     /* blinker */
     sethigh_1bit(DDRB, DDB7);
 }
 
-void InitPWM()
+/* 16-bit timers in registry order; timers 1 and 4 first so channels 0-5
+   keep their original pins */
+static const uint8_t pwm_timer_n[4] = {1, 4, 3, 5};
+
+/* pwm config values (max, min, idle, step) per channel of those timers */
+static const uint16_t pwm_config[12][4] PROGMEM = {
+    /* timer1 [pins 11, 12, 13]; -90 to 90 deg with increments of 3 deg */
+    {72, 14, 72, PWM_INC}, {50, 38, 40, PWM_INC}, {65, 55, 55, PWM_INC},
+    /* timer4 [pins 6, 7, 8] */
+    {65, 55, 57, PWM_INC}, {72, 14, 40, PWM_INC}, {72, 51, 72, PWM_INC},
+    /* timer3 [pins 5, 2, 3] */
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC},
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC},
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC},
+    /* timer5 [pins 46, 45, 44] */
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC},
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC},
+    {PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC}
+};
+
+/* # Limits of registry channel ch; calibrated, else the compiled default */
+static void servo_Config(PWM *pwm, uint8_t ch, const uint16_t *config_P,
+                         uint16_t config[4])
 {
+    const uint16_t *stored = CALIB_Config(ch);
 
-    /* Initialize timer objects */
-    TIMER_Init(&timer1, 1);
-    TIMER_Init(&timer4, 4);
+    /* a stored entry that does not fit this build's period is ignored */
+    if(stored != NULL && PWM_LimitsValid(pwm, stored))
+        memcpy(config, stored, 4 * sizeof(uint16_t));
+    else
+        memcpy_P(config, config_P, 4 * sizeof(uint16_t));
+}
 
-    PWM_TimerConfig(&pwm_grp[0], &timer1, SERVO_PWM);
-    PWM_TimerConfig(&pwm_grp[1], &timer4, SERVO_PWM);
+/* default of every software servo */
+static const uint16_t sservo_config[4] PROGMEM = {
+    PWM_HIGH, PWM_LOW, PWM_IDLE, PWM_INC
+};
 
-    /* pwm config values (max, min, idle, step) */
+void InitPWM()
+{
+    uint16_t config[4];
+    uint8_t g, t, chn_x;
 
-    /* Configured for -90 to 90 deg with increments of 3 deg */
-    uint16_t pwm_config_A0[4] = {72, 14, 72, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[0],pwm_config_A0, chn_A);
+    /* calibration from EEPROM; one bulk read */
+    CALIB_Init(3 * (PWM_GROUPS + SSERVO_GROUPS));
 
-    uint16_t pwm_config_B0[4] = {50, 38, 40, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[0],pwm_config_B0, chn_B);
+    /* start all timers in phase so their frames line up */
+    TIMER_SyncHold();
+    for(g = 0, t = 0; t < 4; t++)
+    {
+        if(pwm_timer_n[t] == SSERVO_TIMER) continue;
 
-    uint16_t pwm_config_C0[4] = {65, 55, 55, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[0],pwm_config_C0, chn_C);
+        TIMER_Init(&timer_grp[g], pwm_timer_n[t]);
+        PWM_TimerConfig(&pwm_grp[g], &timer_grp[g], SERVO_PWM);
 
-    uint16_t pwm_config_A1[4] = {65, 55, 57, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[1],pwm_config_A1, chn_A);
+        for(chn_x = chn_A; chn_x <= chn_C; chn_x++)
+        {
+            servo_Config(&pwm_grp[g], 3 * g + chn_x, pwm_config[3 * t + chn_x],
+                         config);
+            PWM_PwmConfig(&pwm_grp[g], config, chn_x);
+        }
+        g++;
+    }
+    TIMER_SyncRelease();
 
-    uint16_t pwm_config_B1[4] = {72, 14, 40, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[1],pwm_config_B1, chn_B);
+    /* background motion engine; ramps run from the timer1 frame interrupt.
+       registry channel 3 * g + chn_x is channel chn_x of the g-th group */
+    for(g = 0; g < PWM_GROUPS; g++)
+        MOTION_Attach(&pwm_grp[g]);
 
-    uint16_t pwm_config_C1[4] = {72, 51, 72, PWM_INC};
-    PWM_PwmConfig(&pwm_grp[1],pwm_config_C1, chn_C);
+#if SSERVO_TIMER
+    /* software servos, all on the same default config */
+    for(g = 0; g < SSERVO_GROUPS; g++)
+    {
+        SSERVO_Attach(&sservo_grp[g], g);
+        for(chn_x = chn_A; chn_x <= chn_C; chn_x++)
+        {
+            servo_Config(&sservo_grp[g], 3 * (PWM_GROUPS + g) + chn_x,
+                         sservo_config, config);
+            PWM_PwmConfig(&sservo_grp[g], config, chn_x);
+        }
+        MOTION_Attach(&sservo_grp[g]);
+    }
+    SSERVO_Init(sservo_pin);
+#endif
 
+    MOTION_Init();
+    RECORD_Init();
+    KEYMAP_Init();
 
-    /* pick PWM11 [PIN B] */
-    pwm_select = 0;
-    pwm_select_char = 'B';
-    pwm_chn = chn_B;
+    /* pick PWM12 [channel B of timer1] */
+    servo_select = 1;
 }
 
 void InitState()
@@ -567,47 +1032,131 @@ void InitState()
 
     status.cmd_check = FALSE;
     status.cmd_executed = FALSE;
-    status.rx_int = FALSE;
-    status.esc_char = FALSE;
-    status.bracket = FALSE;
 
     err_no = 0;
     argv[0] = UART_RxBuffer;
+
+    /* sorted command index */
+    cli_Init();
+
+    /* saved macros; their commands are looked up in the index */
+    MACRO_Init();
+
+    /* binary protocol idles on the console until 'binary' */
+    PROTO_Init(uart_console);
+
+    /* 1 ms tick and idle sleep */
+    TICK_Init();
 }
 
+/* ------- */
+/*  Tasks  */
+/* ------- */
 
-/* ----------- */
-/*  Main Loop  */
-/* ----------- */
-int main()
+/* bytes handled per run of the input task before others get a turn */
+#define SERVO_INPUT_BURST 16
+
+static int8_t task_input;
+static int8_t task_cli;
+
+/* # Key handlers of the current context, and the binary link port */
+void task_Input()
 {
-    /* hardware */
-    InitUART();
-    InitPWM();
+    uint8_t n;
 
-    /* software */
-    InitState();
+    /* binary protocol on a link port runs in every context */
+    if(PROTO_Port() != uart_console) binary_Keypress();
 
-    /* superloop */
-    while(1)
+    for(n = 0; n < SERVO_INPUT_BURST && uart_RxAvailable(); n++)
     {
         switch(context)
         {
             case context_cli:
-                if(status.rx_int == TRUE) cli_Keypress();
-                cli_ParseCommand(CMD_LIST_LEN);
+                cli_Keypress();
             break;
 
             case context_manual:
-                if(status.rx_int == TRUE) manual_Keypress();
+                manual_Keypress();
             break;
 
             case context_game:
-                if(status.rx_int == TRUE) game_Keypress();
+                game_Keypress();
+            break;
+
+            case context_binary:
+                binary_Keypress();
             break;
 
             default:
             break;
         }
+
+        /* a complete line waits for the parser */
+        if(status.cmd_check)
+        {
+            SCHED_Trigger(task_cli);
+            return;
+        }
     }
+
+    if(uart_RxAvailable()) SCHED_Trigger(task_input);
+}
+
+/* # Sample the share of the last second spent asleep
+
+   Periodic; a late run just covers a slightly longer window.
+*/
+void task_Load()
+{
+    static uint32_t last_ms, last_sleep;
+    uint32_t now = TICK_Ms();
+    uint32_t asleep = TICK_SleepMs();
+
+    if(now != last_ms)
+        servo_idle_recent = ((asleep - last_sleep) * 1000) / (now - last_ms);
+    last_ms = now;
+    last_sleep = asleep;
+}
+
+/* # Parse and run a complete command line */
+void task_Cli()
+{
+    cli_ParseCommand();
+
+    /* input held back while the line was pending */
+    if(uart_RxAvailable()) SCHED_Trigger(task_input);
+}
+
+/* # Register the tasks
+
+   cli is added ahead of input at the same priority: every received byte
+   makes input ready, and a pending line must be parsed before input can
+   take anything more.
+*/
+void InitTasks()
+{
+    task_cli = SCHED_Add(task_Cli, PSTR("cli"), SCHED_PRIO_HIGH, 0, 0);
+    task_input = SCHED_Add(task_Input, PSTR("input"), SCHED_PRIO_HIGH, 0, EVENT_RX);
+    SCHED_Add(task_Keys, PSTR("keys"), SCHED_PRIO_HIGH, 0, EVENT_FRAME);
+    SCHED_Add(RECORD_Poll, PSTR("record"), SCHED_PRIO_HIGH, 0, EVENT_FRAME);
+    SCHED_Add(MACRO_Poll, PSTR("macro"), SCHED_PRIO_NORMAL, 0, EVENT_FRAME);
+    SCHED_Add(task_Load, PSTR("load"), SCHED_PRIO_LOW, 1000, 0);
+}
+
+/* ----------- */
+/*  Main Loop  */
+/* ----------- */
+
+int main()
+{
+    /* hardware */
+    InitUART();
+    InitPWM();
+
+    /* software */
+    InitState();
+    InitTasks();
+
+    /* run-to-completion tasks; sleeps when none is ready */
+    SCHED_Run();
 }
@@ -34,23 +34,24 @@ struct GLOBAL_FLAGS {
   uint8_t cmd_check:1;
   /* True when valid command is executing */
   uint8_t cmd_executed:1;
-  /* True when RX interrupt received */
-  uint8_t rx_int:1;
-  /* True when escape character received */
-  uint8_t esc_char:1;
-  /* True when [ received */
-  uint8_t bracket:1;
   /* Dummy bits to fill up a byte */
-  uint8_t dummy:3;
+  uint8_t dummy:6;
 }; 
 
 volatile struct GLOBAL_FLAGS status;
 
+/* Event mask; bits set by interrupts, cleared by the superloop */
+#define EVENT_RX    0x01
+#define EVENT_FRAME 0x02
+#define EVENT_TICK  0x04
+
+volatile uint8_t events;
+
 /* context */
-#define N_CONTEXT_TYPES 3
+#define N_CONTEXT_TYPES 4
 enum context_types
 {
-  context_cli, context_manual, context_game
+  context_cli, context_manual, context_game, context_binary
 };
 
 volatile uint8_t context;
@@ -0,0 +1,233 @@
+/*==============================================================================
+  Function declarations and data structures for the terminal key decoder
+ =============================================================================*/
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "global.h"
+#include "uart.h"
+#include "tick.h"
+#include "key.h"
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+typedef enum {key_ground, key_esc, key_csi, key_ss3} KEY_State;
+
+static KEY_State key_state;
+
+/* CSI parameters; only the first two are kept */
+static uint8_t key_param[2];
+static uint8_t key_n_param;
+
+/* key repeat detection */
+static uint16_t key_last;
+static uint32_t key_last_ms;
+static uint8_t key_repeats;
+
+/* final byte 'A'..'Z' of CSI / SS3 sequences -> key */
+static const uint8_t key_final[26] PROGMEM = {
+    KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT,   /* A B C D */
+    0, KEY_END, 0, KEY_HOME,                 /* E F G H */
+    0, 0, 0, 0, 0, 0, 0,                     /* I .. O */
+    KEY_F1, KEY_F1 + 1, KEY_F1 + 2, KEY_F1 + 3,  /* P Q R S */
+    0, 0, 0, 0, 0, 0, 0                      /* T .. Z */
+};
+
+/* first parameter of CSI n ~ sequences -> key */
+static const uint8_t key_tilde[25] PROGMEM = {
+    0, KEY_HOME, KEY_INSERT, KEY_DELETE, KEY_END, KEY_PGUP, KEY_PGDN,
+    KEY_HOME, KEY_END, 0, 0,
+    KEY_F1, KEY_F1 + 1, KEY_F1 + 2, KEY_F1 + 3, KEY_F1 + 4, 0,
+    KEY_F1 + 5, KEY_F1 + 6, KEY_F1 + 7, KEY_F1 + 8, KEY_F1 + 9, 0,
+    KEY_F1 + 10, KEY_F1 + 11
+};
+
+/* names of the special keys, KEY_UP onwards */
+static const char key_names[] PROGMEM =
+    "up\0down\0right\0left\0home\0end\0ins\0del\0pgup\0pgdn\0"
+    "f1\0f2\0f3\0f4\0f5\0f6\0f7\0f8\0f9\0f10\0f11\0f12\0";
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+void KEY_Reset()
+{
+    key_state = key_ground;
+    key_last = KEY_NONE;
+}
+
+/* # Key and modifiers at the end of a CSI sequence
+
+   The xterm modifier parameter is 1 + [shift | alt << 1 | ctrl << 2].
+*/
+static uint16_t KEY_Csi(uint8_t final)
+{
+    uint8_t code = 0, mods = 0;
+
+    if(final == '~')
+    {
+        if(key_param[0] < sizeof(key_tilde))
+            code = pgm_read_byte(&key_tilde[key_param[0]]);
+    }
+    else if(final >= 'A' && final <= 'Z')
+        code = pgm_read_byte(&key_final[final - 'A']);
+
+    if(key_n_param >= 2 && key_param[1] > 1)
+        mods = (key_param[1] - 1) & (KEY_MOD_SHIFT | KEY_MOD_ALT | KEY_MOD_CTRL);
+
+    return (code == 0) ? KEY_NONE : ((uint16_t) mods << 8) | code;
+}
+
+/* # Decode one received byte
+
+   Unknown sequences are dropped whole. A lone ESC is only reported once
+   the next byte shows it did not start a sequence [ESC ESC].
+*/
+uint16_t KEY_Feed(uint8_t data)
+{
+    uint8_t code;
+
+    switch(key_state)
+    {
+        case key_ground:
+            if(data == KEY_ESC)
+            {
+                key_state = key_esc;
+                return KEY_NONE;
+            }
+        return data;
+
+        case key_esc:
+            if(data == '[')
+            {
+                key_param[0] = 0;
+                key_param[1] = 0;
+                key_n_param = 1;
+                key_state = key_csi;
+                return KEY_NONE;
+            }
+            if(data == 'O')
+            {
+                key_state = key_ss3;
+                return KEY_NONE;
+            }
+            key_state = key_ground;
+
+            /* ESC ESC: the first was the Escape key */
+            if(data == KEY_ESC)
+                return KEY_ESC;
+        return ((uint16_t) KEY_MOD_ALT << 8) | data;
+
+        case key_csi:
+            if(data >= '0' && data <= '9')
+            {
+                if(key_n_param <= 2)
+                    key_param[key_n_param - 1] =
+                        key_param[key_n_param - 1] * 10 + (data - '0');
+                return KEY_NONE;
+            }
+            if(data == ';')
+            {
+                if(key_n_param < 3) key_n_param++;
+                return KEY_NONE;
+            }
+            key_state = key_ground;
+
+            /* final byte */
+            if(data >= 0x40 && data <= 0x7E)
+                return KEY_Csi(data);
+        return KEY_NONE;
+
+        case key_ss3:
+            key_state = key_ground;
+            if(data >= 'A' && data <= 'Z')
+            {
+                code = pgm_read_byte(&key_final[data - 'A']);
+                if(code != 0) return code;
+            }
+        return KEY_NONE;
+    }
+
+    key_state = key_ground;
+    return KEY_NONE;
+}
+
+/* # Step size for a key event
+
+   The same event within KEY_REPEAT_MS of the previous one is a repeat of
+   a held key; anything else starts over at 1.
+*/
+uint8_t KEY_Accel(uint16_t key)
+{
+    uint32_t now = TICK_Ms();
+    uint8_t shift;
+
+    if(key == key_last && now - key_last_ms < KEY_REPEAT_MS)
+    {
+        if(key_repeats < 0xFF) key_repeats++;
+    }
+    else
+        key_repeats = 0;
+
+    key_last = key;
+    key_last_ms = now;
+
+    shift = key_repeats / KEY_ACCEL_REPEATS;
+    if(shift > 7) shift = 7;
+    return ((1 << shift) > KEY_ACCEL_MAX) ? KEY_ACCEL_MAX : 1 << shift;
+}
+
+/* # Name of special key code; NULL for any other code */
+static const char * KEY_NameP(uint8_t code)
+{
+    const char *name = key_names;
+
+    if(code < KEY_UP || code > KEY_F12)
+        return NULL;
+
+    for(; code > KEY_UP; code--)
+        name += strlen_P(name) + 1;
+    return name;
+}
+
+/* # Key code from a name, a single character or a number */
+uint8_t KEY_FromName(const char *name)
+{
+    const char *name_P;
+    uint8_t code;
+    char *end;
+    unsigned long n;
+
+    if(name[0] != '\0' && name[1] == '\0')
+        return name[0];
+
+    for(code = KEY_UP; code <= KEY_F12; code++)
+    {
+        name_P = KEY_NameP(code);
+        if(strcmp_P(name, name_P) == 0)
+            return code;
+    }
+
+    n = strtoul(name, &end, 0);
+    return (*end == '\0' && n < 256) ? n : KEY_NONE;
+}
+
+/* # Send the name of a key code; printable characters as themselves */
+void KEY_SendName(uint8_t code)
+{
+    const char *name_P = KEY_NameP(code);
+
+    if(name_P != NULL)
+        uart_SendString_P(name_P);
+    else if(code > ' ' && code < 0x7F)
+        uart_SendByte(code);
+    else
+    {
+        uart_SendString_P(PSTR("0x"));
+        uart_SendHex(code, 2);
+    }
+}
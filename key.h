@@ -0,0 +1,87 @@
+/*==============================================================================
+  Header for the terminal key decoder
+
+    Description
+    -----------
+    A state machine fed one received byte at a time [KEY_Feed] that turns
+    ANSI / VT100 / xterm escape sequences into key events. Plain bytes come
+    out as themselves; arrows, Home/End, Insert/Delete, PgUp/PgDn and F1 to
+    F12 get codes from 0x80 up, with the xterm modifier parameter
+    [ESC [ 1 ; 5 A is Ctrl+Up] in the high byte. ESC followed by a plain
+    byte is that byte with Alt.
+
+    The CLI, manual and game mode all read their input through the one
+    decoder.
+
+    A held key shows up as a stream of the same event; KEY_Accel turns the
+    repeat count into a growing step size so a long sweep takes a fraction
+    of the keystrokes.
+
+    Final bytes are looked up in flash tables, so every byte costs the
+    same handful of instructions.
+
+ =============================================================================*/
+#ifndef KEY_H
+#define KEY_H
+
+#include <stdint.h>
+
+/* key event: code in the low byte, KEY_MOD_* in the high byte */
+#define KEY_CODE(ev) ((uint8_t) (ev))
+#define KEY_MODS(ev) ((uint8_t) ((ev) >> 8))
+
+/* no event [middle of a sequence]; a received NUL is dropped as well */
+#define KEY_NONE 0
+
+/* modifiers */
+#define KEY_MOD_SHIFT 0x01
+#define KEY_MOD_ALT   0x02
+#define KEY_MOD_CTRL  0x04
+
+/* special keys */
+#define KEY_UP     0x80
+#define KEY_DOWN   0x81
+#define KEY_RIGHT  0x82
+#define KEY_LEFT   0x83
+#define KEY_HOME   0x84
+#define KEY_END    0x85
+#define KEY_INSERT 0x86
+#define KEY_DELETE 0x87
+#define KEY_PGUP   0x88
+#define KEY_PGDN   0x89
+#define KEY_F1     0x8A
+/* KEY_F1 + n - 1 up to F12 */
+#define KEY_F12    0x95
+
+#define KEY_ESC    0x1B
+#define KEY_ENTER  13
+
+/* backspace; many terminals send DEL [rubout] instead */
+#define KEY_BACKSPACE 0x08
+#define KEY_RUBOUT    0x7F
+
+/* key repeat: presses of the same key closer than KEY_REPEAT_MS apart
+   [terminal auto-repeat is 25 - 50 ms]; the step doubles every
+   KEY_ACCEL_REPEATS of them */
+#define KEY_REPEAT_MS 150
+#define KEY_ACCEL_REPEATS 8
+#define KEY_ACCEL_MAX 8
+
+// Decode one received byte; returns a key event or KEY_NONE
+extern uint16_t KEY_Feed(uint8_t data);
+
+// Drop a partly received sequence
+extern void KEY_Reset(void);
+
+// Step size for a key event: 1, doubling every KEY_ACCEL_REPEATS
+// repeats while the key is held, up to KEY_ACCEL_MAX
+extern uint8_t KEY_Accel(uint16_t key);
+
+// Key code from a name [up, pgdn, f5 ...], a single character or a
+// number; KEY_NONE if not recognized
+extern uint8_t KEY_FromName(const char *name);
+
+// Send the name of a key code to the console
+extern void KEY_SendName(uint8_t code);
+
+#endif
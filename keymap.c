@@ -0,0 +1,98 @@
+/*==============================================================================
+  Function declarations and data structures for the game mode key bindings
+ =============================================================================*/
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include "global.h"
+#include "uart.h"
+#include "key.h"
+#include "keymap.h"
+
+/* identifies saved bindings; changes with the layout */
+#define KEYMAP_MAGIC 0x4B31
+
+/* ------------------ */
+/*  Extern variables  */
+/* ------------------ */
+
+KEYMAP_ENTRY keymap[KEYMAP_KEYS];
+
+_Static_assert(KEYMAP_EE_ADDR + 2 + sizeof(keymap) <= E2END + 1,
+               "key bindings run past the end of EEPROM");
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* default game layout: channels A0 .. C1 of timers 1 and 4 */
+static const KEYMAP_ENTRY keymap_default[KEYMAP_KEYS] PROGMEM = {
+    /* --- Channel A0 -- */
+    [KEY_RIGHT] = {0, 1},  [KEY_LEFT] = {0, -1},
+
+    /* --- Channel B0 -- */
+    [KEY_UP] = {1, 1},     [KEY_DOWN] = {1, -1},
+
+    /* --- Channel C0 -- */
+    ['W'] = {2, 1},  ['w'] = {2, 1},  ['S'] = {2, -1}, ['s'] = {2, -1},
+
+    /* --- Channel A1 -- */
+    ['F'] = {3, 1},  ['r'] = {3, 1},  ['R'] = {3, -1}, ['f'] = {3, -1},
+
+    /* --- Channel B1 -- */
+    ['A'] = {4, 1},  ['a'] = {4, 1},  ['D'] = {4, -1}, ['d'] = {4, -1},
+
+    /* --- Channel C1 -- */
+    ['>'] = {5, 1},  ['.'] = {5, 1},  ['<'] = {5, -1}, [','] = {5, -1},
+};
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Load saved bindings, or copy the defaults from flash */
+void KEYMAP_Init()
+{
+    if(eeprom_read_word((const uint16_t *) KEYMAP_EE_ADDR) == KEYMAP_MAGIC)
+        eeprom_read_block(keymap, (const void *) (KEYMAP_EE_ADDR + 2),
+                          sizeof(keymap));
+    else
+        KEYMAP_Reset();
+}
+
+void KEYMAP_Bind(uint8_t code, uint8_t ch, int8_t delta)
+{
+    keymap[code].ch = (delta == 0) ? 0 : ch;
+    keymap[code].delta = delta;
+}
+
+void KEYMAP_Reset()
+{
+    memcpy_P(keymap, keymap_default, sizeof(keymap));
+}
+
+/* # Write the bindings to EEPROM; only changed bytes are programmed */
+void KEYMAP_Save()
+{
+    eeprom_update_word((uint16_t *) KEYMAP_EE_ADDR, KEYMAP_MAGIC);
+    eeprom_update_block(keymap, (void *) (KEYMAP_EE_ADDR + 2), sizeof(keymap));
+}
+
+void KEYMAP_List()
+{
+    uint16_t code;
+
+    uart_SendString_P(PSTR("key ch delta\n\r"));
+    for(code = 0; code < KEYMAP_KEYS; code++)
+    {
+        if(keymap[code].delta == 0) continue;
+
+        KEY_SendName(code);
+        uart_SendByte(' ');
+        uart_SendUInt(keymap[code].ch);
+        uart_SendByte(' ');
+        uart_SendInt(keymap[code].delta);
+        uart_SendString_P(PSTR("\n\r"));
+    }
+}
@@ -0,0 +1,50 @@
+/*==============================================================================
+  Header for the game mode key bindings
+
+    Description
+    -----------
+    One entry per key code [KEY_CODE of a KEY_Feed event]: the registry
+    channel it drives and the signed number of levels per press. A key
+    press is a single indexed load from keymap; there is no search and no
+    branch per key. Entries with delta 0 are unbound.
+
+    The defaults are a flash table copied to RAM at init, where KEYMAP_Bind
+    changes them. KEYMAP_Save keeps the bindings of a rig in EEPROM at
+    KEYMAP_EE_ADDR; they are loaded in place of the defaults from then on.
+
+ =============================================================================*/
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+
+#define KEYMAP_KEYS 256
+
+/* EEPROM location; above the macros */
+#define KEYMAP_EE_ADDR 0xA00
+
+typedef struct KEYMAP_ENTRY
+{
+    uint8_t ch;
+    int8_t delta;
+} KEYMAP_ENTRY;
+
+/* live bindings, indexed by key code */
+extern KEYMAP_ENTRY keymap[KEYMAP_KEYS];
+
+// Load saved bindings from EEPROM, or the defaults
+extern void KEYMAP_Init(void);
+
+// Bind key code to delta levels of channel ch; delta 0 unbinds
+extern void KEYMAP_Bind(uint8_t code, uint8_t ch, int8_t delta);
+
+// Back to the compiled defaults [EEPROM is left alone]
+extern void KEYMAP_Reset(void);
+
+// Write the bindings to EEPROM
+extern void KEYMAP_Save(void);
+
+// Print every bound key
+extern void KEYMAP_List(void);
+
+#endif
@@ -0,0 +1,340 @@
+/*==============================================================================
+  Function declarations and data structures for the macro engine
+ =============================================================================*/
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "global.h"
+#include "uart.h"
+#include "cmd.h"
+#include "motion.h"
+#include "macro.h"
+#include "keymap.h"
+
+/* identifies saved macros; changes with the layout */
+#define MACRO_MAGIC 0x4D32
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* one pre-tokenized command */
+typedef struct MACRO_STEP
+{
+    /* index into cmd_table */
+    uint8_t cmd;
+    uint8_t argc;
+
+    /* runs, and frames to wait after each */
+    uint8_t repeat;
+    uint16_t delay;
+
+    /* argv[0 .. argc - 1], each NUL terminated */
+    char args[MACRO_ARGS];
+} MACRO_STEP;
+
+typedef struct MACRO
+{
+    /* empty string for a free slot */
+    char name[MACRO_NAME_MAX];
+    uint8_t n_steps;
+    MACRO_STEP step[MACRO_STEPS];
+} MACRO;
+
+/* saved ahead of the macros */
+typedef struct MACRO_HEADER
+{
+    uint16_t magic;
+} MACRO_HEADER;
+
+static MACRO macro[MACRO_MAX];
+
+_Static_assert(MACRO_EE_ADDR + sizeof(MACRO_HEADER) + sizeof(macro) <= KEYMAP_EE_ADDR,
+               "macros overlap the key bindings");
+
+/* the running macro; NULL when idle */
+static MACRO * macro_run;
+static uint8_t macro_pos;
+static uint8_t macro_count;
+static uint8_t macro_times;
+static uint16_t macro_due;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # TRUE if all argc strings of step end inside its args buffer */
+static uint8_t MACRO_ArgsValid(const MACRO_STEP *step)
+{
+    const char *end;
+    uint8_t i, used = 0;
+
+    if(step->argc == 0 || step->argc > MACRO_ARGC_MAX)
+        return FALSE;
+
+    for(i = 0; i < step->argc; i++)
+    {
+        end = memchr(&step->args[used], '\0', MACRO_ARGS - used);
+        if(end == NULL)
+            return FALSE;
+
+        used = end - step->args + 1;
+        if(used == MACRO_ARGS && i + 1 < step->argc)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* # Look the commands of macro m up again by name
+
+   The stored cmd_table indices only hold for the build that saved them;
+   every step keeps its command name as argv[0]. FALSE if a command is
+   gone, no longer takes the step's arguments, or the step is corrupt.
+   Needs the command index [cli_Init].
+*/
+static uint8_t MACRO_Resolve(MACRO *m)
+{
+    const CMD_ENTRY *entry;
+    MACRO_STEP *step;
+    uint8_t s;
+
+    for(s = 0; s < m->n_steps; s++)
+    {
+        step = &m->step[s];
+        if(!MACRO_ArgsValid(step))
+            return FALSE;
+
+        entry = cli_FindCommand(step->args);
+        if(entry == NULL || strcmp(step->args, "macro") == 0 ||
+           step->argc < pgm_read_byte(&entry->min_argc))
+            return FALSE;
+
+        step->cmd = entry - cmd_table;
+    }
+    return TRUE;
+}
+
+/* # Load saved macros from EEPROM
+
+   Commands are resolved by name against this build's table; a macro
+   using a command that is gone is dropped.
+*/
+void MACRO_Init()
+{
+    MACRO_HEADER hdr;
+    uint8_t i;
+
+    macro_run = NULL;
+
+    eeprom_read_block(&hdr, (const void *) MACRO_EE_ADDR, sizeof(hdr));
+    if(hdr.magic != MACRO_MAGIC)
+        return;
+
+    eeprom_read_block(macro, (const void *) (MACRO_EE_ADDR + sizeof(hdr)),
+                      sizeof(macro));
+
+    for(i = 0; i < MACRO_MAX; i++)
+    {
+        if(!macro[i].name[0]) continue;
+
+        macro[i].name[MACRO_NAME_MAX - 1] = '\0';
+        if(macro[i].n_steps > MACRO_STEPS || !MACRO_Resolve(&macro[i]))
+            macro[i].name[0] = '\0';
+    }
+}
+
+/* # Write all macros to EEPROM; only changed bytes are programmed */
+void MACRO_Save()
+{
+    MACRO_HEADER hdr;
+
+    hdr.magic = MACRO_MAGIC;
+    eeprom_update_block(&hdr, (void *) MACRO_EE_ADDR, sizeof(hdr));
+    eeprom_update_block(macro, (void *) (MACRO_EE_ADDR + sizeof(hdr)),
+                        sizeof(macro));
+}
+
+static MACRO * MACRO_Find(const char *name)
+{
+    uint8_t i;
+
+    for(i = 0; i < MACRO_MAX; i++)
+        if(macro[i].name[0] && strncmp(macro[i].name, name, MACRO_NAME_MAX) == 0)
+            return &macro[i];
+    return NULL;
+}
+
+/* # Append a step to macro name, creating it
+
+   The command is looked up and its arguments packed here, once. delay is
+   in frames, up to MACRO_DELAY_MAX. Returns 0 or a MACRO_ERR_ code.
+*/
+int MACRO_Add(const char *name, uint8_t repeat, uint16_t delay,
+              uint8_t argc, char **argv)
+{
+    const CMD_ENTRY *entry;
+    MACRO *m;
+    MACRO_STEP *step;
+    uint8_t i, len, used = 0;
+
+    if(macro_run != NULL)
+        return MACRO_ERR_BUSY;
+
+    /* macros do not run macros */
+    entry = (argc > 0) ? cli_FindCommand(argv[0]) : NULL;
+    if(entry == NULL || strcmp(argv[0], "macro") == 0)
+        return MACRO_ERR_COMMAND;
+    if(argc < pgm_read_byte(&entry->min_argc) || argc > MACRO_ARGC_MAX ||
+       delay > MACRO_DELAY_MAX)
+        return MACRO_ERR_ARGS;
+
+    m = MACRO_Find(name);
+    if(m == NULL)
+    {
+        if(strlen(name) >= MACRO_NAME_MAX)
+            return MACRO_ERR_ARGS;
+        for(i = 0; i < MACRO_MAX && macro[i].name[0]; i++)
+        ;
+        if(i == MACRO_MAX)
+            return MACRO_ERR_FULL;
+        m = &macro[i];
+        strcpy(m->name, name);
+        m->n_steps = 0;
+    }
+    if(m->n_steps == MACRO_STEPS)
+        return MACRO_ERR_FULL;
+
+    step = &m->step[m->n_steps];
+    for(i = 0; i < argc; i++)
+    {
+        len = strlen(argv[i]) + 1;
+        if(used + len > MACRO_ARGS)
+        {
+            if(m->n_steps == 0) m->name[0] = '\0';
+            return MACRO_ERR_ARGS;
+        }
+        memcpy(&step->args[used], argv[i], len);
+        used += len;
+    }
+
+    step->cmd = entry - cmd_table;
+    step->argc = argc;
+    step->repeat = (repeat == 0) ? 1 : repeat;
+    step->delay = delay;
+    m->n_steps++;
+    return 0;
+}
+
+/* # Remove macro name */
+int MACRO_Delete(const char *name)
+{
+    MACRO *m = MACRO_Find(name);
+
+    if(m == NULL)
+        return MACRO_ERR_UNKNOWN;
+    if(m == macro_run)
+        return MACRO_ERR_BUSY;
+
+    m->name[0] = '\0';
+    return 0;
+}
+
+/* # Run macro name times over; 0 repeats it until stopped */
+int MACRO_Run(const char *name, uint8_t times)
+{
+    MACRO *m = MACRO_Find(name);
+
+    if(m == NULL || m->n_steps == 0)
+        return MACRO_ERR_UNKNOWN;
+
+    macro_pos = 0;
+    macro_count = 0;
+    macro_times = times;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        macro_due = motion_frame;
+    }
+    macro_run = m;
+    return 0;
+}
+
+void MACRO_Stop()
+{
+    macro_run = NULL;
+}
+
+/* # Run the next step if it is due
+
+   Main loop context, so commands reply on the console as if typed. The
+   argument vector is rebuilt from the packed strings; the callback comes
+   straight from cmd_table.
+*/
+void MACRO_Poll()
+{
+    char *argv_step[MACRO_ARGC_MAX];
+    MACRO_STEP *step;
+    CMD_Callback callback;
+    uint16_t now;
+    uint8_t i;
+    char *p;
+
+    if(macro_run == NULL) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = motion_frame;
+    }
+    if((int16_t) (now - macro_due) < 0) return;
+
+    step = &macro_run->step[macro_pos];
+    for(i = 0, p = step->args; i < step->argc; i++, p += strlen(p) + 1)
+        argv_step[i] = p;
+
+    callback = (CMD_Callback) pgm_read_ptr(&cmd_table[step->cmd].callback);
+    err_no = callback(step->argc, argv_step);
+    macro_due = now + step->delay;
+
+    /* next run of this step, the next step, or the next pass */
+    if(++macro_count < step->repeat) return;
+    macro_count = 0;
+
+    if(++macro_pos < macro_run->n_steps) return;
+    macro_pos = 0;
+
+    if(macro_times != 0 && --macro_times == 0)
+        macro_run = NULL;
+}
+
+/* # Print macros and their steps */
+void MACRO_List()
+{
+    MACRO_STEP *step;
+    uint8_t i, s, a;
+    char *p;
+
+    for(i = 0; i < MACRO_MAX; i++)
+    {
+        if(!macro[i].name[0]) continue;
+
+        uart_SendString(macro[i].name);
+        uart_SendString_P(PSTR(":\n\r"));
+        for(s = 0; s < macro[i].n_steps; s++)
+        {
+            step = &macro[i].step[s];
+            uart_SendString_P(PSTR("  "));
+            for(a = 0, p = step->args; a < step->argc; a++, p += strlen(p) + 1)
+            {
+                uart_SendString(p);
+                uart_SendByte(' ');
+            }
+            uart_SendString_P(PSTR(" x"));
+            uart_SendUInt(step->repeat);
+            uart_SendString_P(PSTR(" +"));
+            uart_SendUInt(step->delay);
+            uart_SendString_P(PSTR(" frames\n\r"));
+        }
+    }
+}
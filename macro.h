@@ -0,0 +1,69 @@
+/*==============================================================================
+  Header for the macro engine
+
+    Description
+    -----------
+    Named sequences of CLI commands run on the device. A step is stored
+    pre-tokenized when it is defined: the command's cmd_table index, argc
+    and the argument strings back to back. Running a step is a table
+    lookup and a call; nothing goes through tokenize or the name search.
+
+    Each step runs repeat times with delay frames after every run, timed
+    on the motion engine's frame counter. Macros are kept in RAM and can
+    be saved to EEPROM at MACRO_EE_ADDR. At init every step's command is
+    looked up again by its name, so a rebuilt command table cannot send a
+    saved step to the wrong callback; macros using a command that is gone
+    are dropped.
+
+ =============================================================================*/
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stdint.h>
+
+#define MACRO_MAX 4
+#define MACRO_STEPS 8
+#define MACRO_NAME_MAX 8
+
+/* argument bytes of a step, the command name and NULs included */
+#define MACRO_ARGS 16
+#define MACRO_ARGC_MAX 8
+
+/* longest delay after a step [frames]; due frames are compared signed */
+#define MACRO_DELAY_MAX 32767
+
+/* EEPROM location; above the recording */
+#define MACRO_EE_ADDR 0x600
+
+/* error codes of MACRO_Add / MACRO_Run */
+#define MACRO_ERR_COMMAND -1
+#define MACRO_ERR_ARGS    -2
+#define MACRO_ERR_FULL    -3
+#define MACRO_ERR_UNKNOWN -4
+#define MACRO_ERR_BUSY    -5
+
+// Load saved macros from EEPROM [after cli_Init]
+extern void MACRO_Init(void);
+
+// Append a step to macro name, creating it; argv[0] is the command,
+// delay at most MACRO_DELAY_MAX
+extern int MACRO_Add(const char *name, uint8_t repeat, uint16_t delay,
+                     uint8_t argc, char **argv);
+
+// Remove macro name
+extern int MACRO_Delete(const char *name);
+
+// Run macro name times over [0 until stopped]
+extern int MACRO_Run(const char *name, uint8_t times);
+extern void MACRO_Stop(void);
+
+// Run the next step if it is due [main loop]
+extern void MACRO_Poll(void);
+
+// Write all macros to EEPROM
+extern void MACRO_Save(void);
+
+// Print macros and their steps to the console
+extern void MACRO_List(void);
+
+#endif
@@ -0,0 +1,437 @@
+/*==============================================================================
+  Function declarations and data structures for the motion engine
+ =============================================================================*/
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "global.h"
+#include "pwm.h"
+#include "motion.h"
+#include "record.h"
+
+/* ------------------ */
+/*  Extern variables  */
+/* ------------------ */
+
+volatile uint16_t motion_frame;
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* groups updated every frame */
+static PWM * motion_pwm[MOTION_MAX_GROUPS];
+static uint8_t motion_n_pwm;
+
+/* set while any channel is moving */
+static volatile uint8_t motion_busy;
+
+/* coordinated move; owned by the frame interrupt once active */
+static struct MOTION_SYNC {
+    /* channel on its own profile, and the target it was given */
+    uint8_t leader;
+    uint16_t leader_target;
+    int32_t leader_start;
+    uint16_t leader_dist;
+
+    /* slaved channels [MOTION_MASK_*] */
+    uint8_t mask[MOTION_MASK_BYTES];
+    uint8_t n_slaves;
+
+    /* per slave: start position [8.8], direction and distance [counts] */
+    int32_t start[MOTION_MAX_CHANNELS];
+    int8_t dir[MOTION_MAX_CHANNELS];
+    uint16_t dist[MOTION_MAX_CHANNELS];
+} motion_sync;
+
+static volatile uint8_t motion_sync_active;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Start the frame interrupt
+
+   Timer1 has to be configured for PWM [PWM_TimerConfig] before this is
+   called; its overflow at BOTTOM marks the start of every PWM frame.
+*/
+void MOTION_Init()
+{
+    motion_frame = 0;
+    motion_busy = FALSE;
+
+    /* clear pending flag and enable overflow interrupt */
+    TIFR1 = (1 << TOV1);
+    sethigh_1bit(TIMSK1, TOIE1);
+}
+
+/* # Add a PWM group to the set updated every frame */
+int MOTION_Attach(PWM *pwm)
+{
+    if(motion_n_pwm >= MOTION_MAX_GROUPS)
+        return -1;
+
+    motion_pwm[motion_n_pwm++] = pwm;
+    return 0;
+}
+
+/* # True while any attached channel has not reached its target */
+uint8_t MOTION_Busy()
+{
+    return motion_busy;
+}
+
+/* # Number of channels attached [3 per group] */
+uint8_t MOTION_Channels()
+{
+    return 3 * motion_n_pwm;
+}
+
+/* # PWM group and channel behind an engine channel index */
+PWM * MOTION_Channel(uint8_t ch, PWM_Channel *chn_x)
+{
+    if(ch >= 3 * motion_n_pwm)
+        return NULL;
+
+    *chn_x = ch % 3;
+    return motion_pwm[ch / 3];
+}
+
+/* # Level commands by channel index; -1 for an unknown channel
+
+   Steps are passed on to the recorder [RECORD_Event].
+*/
+int MOTION_Inc(uint8_t ch)
+{
+    PWM_Channel chn_x;
+    PWM *pwm = MOTION_Channel(ch, &chn_x);
+
+    if(pwm == NULL) return -1;
+
+    RECORD_Event(ch, 1);
+    return PWM_Inc(pwm, chn_x);
+}
+
+int MOTION_Dec(uint8_t ch)
+{
+    PWM_Channel chn_x;
+    PWM *pwm = MOTION_Channel(ch, &chn_x);
+
+    if(pwm == NULL) return -1;
+
+    RECORD_Event(ch, -1);
+    return PWM_Dec(pwm, chn_x);
+}
+
+/* # Net delta of several key presses in one go
+
+   Recorded as the single steps it stands for; stops at the channel's
+   limit, so a clamped step leaves nothing in the recording.
+*/
+int MOTION_Step(uint8_t ch, int8_t delta)
+{
+    PWM_Channel chn_x;
+    PWM *pwm = MOTION_Channel(ch, &chn_x);
+
+    if(pwm == NULL) return -1;
+
+    for(; delta > 0 && pwm->pwm_level[chn_x] < pwm->pwm_level_max[chn_x]; delta--)
+    {
+        RECORD_Event(ch, 1);
+        PWM_Inc(pwm, chn_x);
+    }
+    for(; delta < 0 && pwm->pwm_level[chn_x] > pwm->pwm_level_min[chn_x]; delta++)
+    {
+        RECORD_Event(ch, -1);
+        PWM_Dec(pwm, chn_x);
+    }
+    return 0;
+}
+
+int MOTION_Idle(uint8_t ch)
+{
+    PWM_Channel chn_x;
+    PWM *pwm = MOTION_Channel(ch, &chn_x);
+
+    return (pwm == NULL) ? -1 : PWM_Idle(pwm, chn_x);
+}
+
+/* # Frames a channel needs for distance dist [8.8] along its profile;
+   0 for a channel that does not move */
+static uint32_t MOTION_Frames(PWM *pwm, PWM_Channel chn_x, uint32_t dist)
+{
+    uint16_t vel = pwm->pwm_vel_max[chn_x];
+    uint16_t acc = pwm->pwm_acc_max[chn_x];
+
+    if(dist == 0) return 0;
+
+    /* cruise time plus the time lost ramping up and down */
+    return dist / vel + ((acc == 0) ? 0 : vel / acc);
+}
+
+/* # Stop the coordinated move in progress
+
+   Its slaves carry on to their targets on their own profiles, starting
+   from the velocity the move left them with.
+*/
+static void MOTION_SyncRelease()
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint8_t ch;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        motion_sync_active = FALSE;
+    }
+
+    for(ch = 0; ch < MOTION_Channels(); ch++)
+    {
+        if(!MOTION_MASK_TEST(motion_sync.mask, ch)) continue;
+        pwm = MOTION_Channel(ch, &chn_x);
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            pwm->pwm_sync &= ~(1 << chn_x);
+        }
+    }
+}
+
+/* # Coordinated move
+
+   Channels in mask [MOTION_MASK_SET(mask, ch)] are sent to levels[ch],
+   clamped to each channel's limits. The moving channel needing the
+   longest time becomes the leader and runs its own profile; every other
+   moving channel is placed at the same fraction of its distance each
+   frame. All compare values are written from the one frame interrupt, so
+   with the timers started in phase [TIMER_SyncHold] the hardware timers
+   latch them on the same PWM frame.
+
+   The plan is worked out with interrupts enabled; only reading a position
+   and handing over a channel are atomic, so interrupts are never held off
+   for more than a few instructions. If a frame passed while planning, the
+   positions are stale and the plan is made again.
+
+   Returns 0, or -1 if mask names a channel that is not attached.
+*/
+int MOTION_Move(const uint8_t mask[], const uint16_t levels[])
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint16_t target[MOTION_MAX_CHANNELS];
+    uint32_t dist[MOTION_MAX_CHANNELS];
+    uint32_t frames, frames_max;
+    int32_t pos;
+    uint16_t frame;
+    uint8_t ch, leader, planned = FALSE;
+
+    for(ch = MOTION_Channels(); ch < MOTION_MAX_CHANNELS; ch++)
+        if(MOTION_MASK_TEST(mask, ch))
+            return -1;
+
+    /* a new move replaces the one in progress; the frame interrupt leaves
+       motion_sync alone from here on */
+    if(motion_sync_active)
+        MOTION_SyncRelease();
+
+    while(!planned)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            frame = motion_frame;
+        }
+
+        /* clamp targets and find the slowest moving channel */
+        frames_max = 0;
+        leader = MOTION_MAX_CHANNELS;
+        for(ch = 0; ch < MOTION_Channels(); ch++)
+        {
+            if(!MOTION_MASK_TEST(mask, ch)) continue;
+            pwm = MOTION_Channel(ch, &chn_x);
+
+            if(levels[ch] > pwm->pwm_level_max[chn_x])
+                pwm->pwm_level[chn_x] = pwm->pwm_level_max[chn_x];
+            else if(levels[ch] < pwm->pwm_level_min[chn_x])
+                pwm->pwm_level[chn_x] = pwm->pwm_level_min[chn_x];
+            else
+                pwm->pwm_level[chn_x] = levels[ch];
+
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                pos = pwm->pwm_pos[chn_x];
+            }
+            motion_sync.start[ch] = pos;
+
+            target[ch] = pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x];
+            pos = ((int32_t) target[ch] << 8) - pos;
+            dist[ch] = (pos < 0) ? -pos : pos;
+
+            frames = MOTION_Frames(pwm, chn_x, dist[ch]);
+            if(frames != 0 && frames >= frames_max)
+            {
+                frames_max = frames;
+                leader = ch;
+            }
+        }
+
+        /* slaves follow the leader's progress */
+        for(ch = 0; ch < MOTION_MASK_BYTES; ch++)
+            motion_sync.mask[ch] = 0;
+        motion_sync.n_slaves = 0;
+
+        for(ch = 0; ch < MOTION_Channels(); ch++)
+        {
+            if(!MOTION_MASK_TEST(mask, ch) || ch == leader) continue;
+
+            /* nothing to move, or nothing to follow */
+            if(dist[ch] == 0 || leader == MOTION_MAX_CHANNELS) continue;
+
+            motion_sync.dir[ch] =
+                (((int32_t) target[ch] << 8) < motion_sync.start[ch]) ? -1 : 1;
+            motion_sync.dist[ch] = dist[ch] >> 8;
+
+            MOTION_MASK_SET(motion_sync.mask, ch);
+            motion_sync.n_slaves++;
+        }
+
+        if(leader != MOTION_MAX_CHANNELS)
+        {
+            motion_sync.leader = leader;
+            motion_sync.leader_target = target[leader];
+            motion_sync.leader_start = motion_sync.start[leader];
+            motion_sync.leader_dist = (dist[leader] >> 8) ? dist[leader] >> 8 : 1;
+        }
+
+        /* hand the plan over one channel at a time; a slave holds still
+           until the move is made active */
+        for(ch = 0; ch < MOTION_Channels(); ch++)
+        {
+            if(!MOTION_MASK_TEST(mask, ch)) continue;
+            pwm = MOTION_Channel(ch, &chn_x);
+
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                PWM_SetTarget(pwm, chn_x, target[ch]);
+                if(MOTION_MASK_TEST(motion_sync.mask, ch))
+                    pwm->pwm_sync |= (1 << chn_x);
+            }
+        }
+
+        /* start it, unless a frame has made the positions stale */
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if(motion_frame == frame)
+            {
+                motion_sync_active = (motion_sync.n_slaves != 0);
+                planned = TRUE;
+            }
+        }
+
+        if(!planned)
+            MOTION_SyncRelease();
+    }
+    return 0;
+}
+
+/* # Place slaved channels at the leader's fraction of the move
+
+   Frame interrupt context, after the leader's profile step. The move ends
+   when the leader comes to rest on its target, snapping every slave onto
+   its own target in the same frame. If the leader is given another
+   target the slaves are released with their current velocity.
+*/
+static void MOTION_SyncUpdate()
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint32_t progress;
+    int32_t pos;
+    uint8_t ch, done, cancelled;
+
+    pwm = MOTION_Channel(motion_sync.leader, &chn_x);
+    cancelled = (pwm->pwm_target[chn_x] != motion_sync.leader_target);
+    done = (pwm->pwm_vel[chn_x] == 0) &&
+        (pwm->pwm_pos[chn_x] == ((int32_t) motion_sync.leader_target << 8));
+
+    /* leader's fraction of the move [0.16 fixed-point]; one division */
+    pos = pwm->pwm_pos[chn_x] - motion_sync.leader_start;
+    progress = ((uint32_t) ((pos < 0) ? -pos : pos) << 8) / motion_sync.leader_dist;
+    if(progress > 0x10000) progress = 0x10000;
+
+    for(ch = 0; ch < MOTION_Channels(); ch++)
+    {
+        if(!MOTION_MASK_TEST(motion_sync.mask, ch)) continue;
+        pwm = MOTION_Channel(ch, &chn_x);
+
+        /* retargeted by a command; no longer ours */
+        if(!(pwm->pwm_sync & (1 << chn_x))) continue;
+
+        if(cancelled)
+        {
+            pwm->pwm_sync &= ~(1 << chn_x);
+            continue;
+        }
+
+        if(done)
+        {
+            pos = (int32_t) pwm->pwm_target[chn_x] << 8;
+            pwm->pwm_vel[chn_x] = 0;
+            pwm->pwm_sync &= ~(1 << chn_x);
+        }
+        else
+        {
+            pos = ((uint32_t) motion_sync.dist[ch] * progress) >> 8;
+            pos = motion_sync.start[ch] + motion_sync.dir[ch] * pos;
+
+            /* keep velocity state for a smooth hand-over on release */
+            pwm->pwm_vel[chn_x] = pos - pwm->pwm_pos[chn_x];
+        }
+        pwm->pwm_acc[chn_x] = 0;
+        pwm->pwm_pos[chn_x] = pos;
+        *(pwm->OCRnx[chn_x]) = (uint16_t) ((pos + 0x80) >> 8);
+    }
+
+    if(done || cancelled)
+        motion_sync_active = FALSE;
+}
+
+/* ----------------------- */
+/*  Frame interrupt [20ms] */
+/* ----------------------- */
+
+/* interruptible, so the software servo edges are not held up by a frame
+   of profile steps; the next overflow is 20 ms away. Every compare value
+   of the frame is written inside one open shadow per PWM, so profile and
+   coordinated-move steps reach the outputs together at the next TOP */
+ISR(TIMER1_OVF_vect, ISR_NOBLOCK)
+{
+    uint8_t i;
+    uint8_t busy = FALSE;
+
+    motion_frame++;
+
+    /* other interrupts set events too; this one runs with them enabled */
+    ATOMIC_BLOCK(ATOMIC_FORCEON)
+    {
+        events |= EVENT_FRAME;
+    }
+
+    for(i = 0; i < motion_n_pwm; i++)
+        PWM_ShadowOpen(motion_pwm[i]);
+
+    for(i = 0; i < motion_n_pwm; i++)
+        busy |= PWM_Update(motion_pwm[i]);
+
+    if(motion_sync_active)
+        MOTION_SyncUpdate();
+
+    for(i = 0; i < motion_n_pwm; i++)
+        PWM_ShadowClose(motion_pwm[i]);
+
+#if SSERVO_TIMER
+    SSERVO_Update();
+#endif
+
+    motion_busy = busy;
+}
@@ -0,0 +1,68 @@
+/*==============================================================================
+  Header for the background motion engine
+
+    Description
+    -----------
+    Moves every attached PWM group towards its per-channel targets from the
+    frame timer's overflow interrupt, once per PWM frame. Commands only set
+    targets [PWM_SetTarget, PWM_Inc, PWM_Dec, PWM_Idle] and return at once.
+
+    Coordinated moves [MOTION_Move] run the slowest channel on its own
+    profile and slave the others to its progress, so every channel of the
+    move lands on the same frame.
+
+ =============================================================================*/
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include "pwm.h"
+#include "sservo.h"
+
+/* maximum number of PWM groups driven by the engine; the hardware timers
+   plus the software servo groups */
+#define MOTION_MAX_GROUPS (4 + SSERVO_GROUPS)
+
+/* engine channel index = 3 * group + PWM_Channel, in attach order; this
+   is the channel registry used by commands, modes and the protocol */
+#define MOTION_MAX_CHANNELS (3 * MOTION_MAX_GROUPS)
+
+/* channel bitmaps [MOTION_Move]; one bit per engine channel index */
+#define MOTION_MASK_BYTES ((MOTION_MAX_CHANNELS + 7) / 8)
+#define MOTION_MASK_SET(m, ch)  ((m)[(ch) >> 3] |= (1 << ((ch) & 7)))
+#define MOTION_MASK_TEST(m, ch) ((m)[(ch) >> 3] & (1 << ((ch) & 7)))
+
+/* frame period of the SERVO_PWM preset [us] */
+#define MOTION_FRAME_US \
+    (2UL * SERVO_TOP * SERVO_PRESCALE_DIV / (F_CPU / 1000000UL))
+
+/* frames elapsed since MOTION_Init; incremented in the frame interrupt */
+extern volatile uint16_t motion_frame;
+
+// Start the frame interrupt [timer1 overflow]
+extern void MOTION_Init(void);
+
+// Add a PWM group to the set updated every frame
+extern int MOTION_Attach(PWM * pwm);
+
+// True while any attached channel has not reached its target
+extern uint8_t MOTION_Busy(void);
+
+// Number of channels attached [3 per group]
+extern uint8_t MOTION_Channels(void);
+
+// PWM group and channel behind an engine channel index; NULL if unknown
+extern PWM * MOTION_Channel(uint8_t ch, PWM_Channel * chn_x);
+
+// PWM_Inc / PWM_Dec / PWM_Idle by engine channel index
+extern int MOTION_Inc(uint8_t ch);
+extern int MOTION_Dec(uint8_t ch);
+extern int MOTION_Idle(uint8_t ch);
+
+// delta levels up [or down if negative] at once, as that many Inc / Dec
+extern int MOTION_Step(uint8_t ch, int8_t delta);
+
+// Move the channels in mask to levels[ch] so that all arrive together
+extern int MOTION_Move(const uint8_t mask[], const uint16_t levels[]);
+
+#endif
@@ -0,0 +1,288 @@
+/*==============================================================================
+  Source for the binary command protocol
+ =============================================================================*/
+#include <stddef.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+#include "global.h"
+#include "uart.h"
+#include "pwm.h"
+#include "motion.h"
+#include "proto.h"
+
+/* ------------------ */
+/*  Extern variables  */
+/* ------------------ */
+
+struct PROTO_COUNTERS proto_count;
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* decoder states */
+enum proto_states
+{
+  proto_sync, proto_op, proto_len, proto_payload, proto_crc_lo, proto_crc_hi
+};
+
+static uint8_t proto_state;
+static uint8_t proto_opcode;
+static uint8_t proto_length;
+static uint8_t proto_idx;
+static uint16_t proto_crc;
+static uint8_t proto_buffer[PROTO_MAX_PAYLOAD];
+
+/* port the frames are read from and answered on */
+static UART *proto_port;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Reset the decoder and bind it to a port */
+void PROTO_Init(UART *port)
+{
+    proto_port = port;
+    proto_state = proto_sync;
+}
+
+UART * PROTO_Port()
+{
+    return proto_port;
+}
+
+/* # Send a response frame */
+static void PROTO_SendFrame(uint8_t op, const uint8_t *payload, uint8_t len)
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    crc = _crc_ccitt_update(crc, op);
+    crc = _crc_ccitt_update(crc, len);
+    for(i = 0; i < len; i++)
+        crc = _crc_ccitt_update(crc, payload[i]);
+
+    UART_SendByte(proto_port, PROTO_SYNC);
+    UART_SendByte(proto_port, op);
+    UART_SendByte(proto_port, len);
+    for(i = 0; i < len; i++)
+        UART_SendByte(proto_port, payload[i]);
+    UART_SendByte(proto_port, crc & 0xFF);
+    UART_SendByte(proto_port, crc >> 8);
+}
+
+static void PROTO_Ack(uint8_t op)
+{
+    PROTO_SendFrame(PROTO_OP_ACK, &op, 1);
+}
+
+static void PROTO_Nak(uint8_t op, uint8_t err)
+{
+    uint8_t payload[2] = {op, err};
+    PROTO_SendFrame(PROTO_OP_NAK, payload, 2);
+}
+
+/* # Absolute compare values; n x {ch, counts[2]} */
+static uint8_t PROTO_Set(const uint8_t *payload, uint8_t len)
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint16_t counts, lo, hi;
+    uint8_t i;
+
+    if(len % 3)
+        return PROTO_ERR_LENGTH;
+
+    /* validate everything first so a frame is applied whole or not at all */
+    for(i = 0; i < len; i += 3)
+        if(MOTION_Channel(payload[i], &chn_x) == NULL)
+            return PROTO_ERR_CHANNEL;
+
+    for(i = 0; i < len; i += 3)
+    {
+        pwm = MOTION_Channel(payload[i], &chn_x);
+        counts = payload[i + 1] | ((uint16_t) payload[i + 2] << 8);
+
+        /* clamp to the channel's level limits */
+        lo = pwm->pwm_level_min[chn_x] * pwm->pwm_step[chn_x];
+        hi = pwm->pwm_level_max[chn_x] * pwm->pwm_step[chn_x];
+        if(counts < lo) counts = lo;
+        if(counts > hi) counts = hi;
+
+        pwm->pwm_level[chn_x] = counts / pwm->pwm_step[chn_x];
+        PWM_SetTarget(pwm, chn_x, counts);
+    }
+    return 0;
+}
+
+/* # Coordinated move; n x {ch, level} */
+static uint8_t PROTO_Move(const uint8_t *payload, uint8_t len)
+{
+    uint16_t levels[MOTION_MAX_CHANNELS];
+    uint8_t mask[MOTION_MASK_BYTES] = {0};
+    uint8_t i;
+
+    if(len & 1)
+        return PROTO_ERR_LENGTH;
+
+    for(i = 0; i < len; i += 2)
+    {
+        if(payload[i] >= MOTION_Channels())
+            return PROTO_ERR_CHANNEL;
+        levels[payload[i]] = payload[i + 1];
+        MOTION_MASK_SET(mask, payload[i]);
+    }
+    return MOTION_Move(mask, levels) ? PROTO_ERR_CHANNEL : 0;
+}
+
+/* # Current targets and positions of one page of channels;
+   [{start, count}] */
+static uint8_t PROTO_State(const uint8_t *payload_in, uint8_t len)
+{
+    uint8_t payload[2 + 4 * PROTO_STATE_MAX];
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint16_t target, ocr;
+    uint8_t ch, start = 0, count = PROTO_STATE_MAX, n = 0;
+
+    if(len != 0 && len != 2)
+        return PROTO_ERR_LENGTH;
+    if(len == 2)
+    {
+        start = payload_in[0];
+        if(payload_in[1] != 0 && payload_in[1] < PROTO_STATE_MAX)
+            count = payload_in[1];
+    }
+    if(start >= MOTION_Channels())
+        return PROTO_ERR_CHANNEL;
+    if(count > MOTION_Channels() - start)
+        count = MOTION_Channels() - start;
+
+    payload[n++] = start;
+    payload[n++] = MOTION_Channels();
+    for(ch = start; ch < start + count; ch++)
+    {
+        pwm = MOTION_Channel(ch, &chn_x);
+        target = pwm->pwm_target[chn_x];
+        ocr = *(pwm->OCRnx[chn_x]);
+
+        payload[n++] = target & 0xFF;
+        payload[n++] = target >> 8;
+        payload[n++] = ocr & 0xFF;
+        payload[n++] = ocr >> 8;
+    }
+    PROTO_SendFrame(PROTO_OP_STATE, payload, n);
+    return 0;
+}
+
+/* # Execute a complete, CRC-checked frame */
+static void PROTO_Execute()
+{
+    uint8_t err = 0;
+
+    proto_count.frames++;
+
+    switch(proto_opcode)
+    {
+        case PROTO_OP_PING:
+        break;
+
+        case PROTO_OP_SET:
+            err = PROTO_Set(proto_buffer, proto_length);
+        break;
+
+        case PROTO_OP_MOVE:
+            err = PROTO_Move(proto_buffer, proto_length);
+        break;
+
+        case PROTO_OP_QUERY:
+            err = PROTO_State(proto_buffer, proto_length);
+            if(err == 0) return;
+        break;
+
+        case PROTO_OP_EXIT:
+            PROTO_Ack(proto_opcode);
+            /* a link port of its own has no CLI to return to */
+            if(proto_port == uart_console) context = context_cli;
+        return;
+
+        default:
+            err = PROTO_ERR_OPCODE;
+        break;
+    }
+
+    if(err) PROTO_Nak(proto_opcode, err);
+    else PROTO_Ack(proto_opcode);
+}
+
+/* # Feed one received byte to the frame decoder
+
+   O(1) per byte; the CRC is accumulated as bytes arrive and the frame is
+   executed as soon as its last CRC byte is in.
+*/
+void PROTO_Feed(uint8_t data)
+{
+    switch(proto_state)
+    {
+        case proto_sync:
+            if(data == PROTO_SYNC)
+            {
+                proto_crc = 0xFFFF;
+                proto_state = proto_op;
+            }
+        break;
+
+        case proto_op:
+            proto_opcode = data;
+            proto_crc = _crc_ccitt_update(proto_crc, data);
+            proto_state = proto_len;
+        break;
+
+        case proto_len:
+            if(data > PROTO_MAX_PAYLOAD)
+            {
+                proto_count.length_errors++;
+                proto_state = proto_sync;
+                break;
+            }
+            proto_length = data;
+            proto_idx = 0;
+            proto_crc = _crc_ccitt_update(proto_crc, data);
+            proto_state = (data == 0) ? proto_crc_lo : proto_payload;
+        break;
+
+        case proto_payload:
+            proto_buffer[proto_idx++] = data;
+            proto_crc = _crc_ccitt_update(proto_crc, data);
+            if(proto_idx == proto_length) proto_state = proto_crc_lo;
+        break;
+
+        case proto_crc_lo:
+            proto_crc ^= data;
+            proto_state = proto_crc_hi;
+        break;
+
+        case proto_crc_hi:
+            proto_crc ^= (uint16_t) data << 8;
+            proto_state = proto_sync;
+
+            if(proto_crc == 0) PROTO_Execute();
+            else proto_count.crc_errors++;
+        break;
+    }
+}
+
+/* # Drain the port's RX ring through the decoder
+
+   On the console, stops early if a frame switched back to the CLI,
+   leaving the rest of the input for cli_Keypress.
+*/
+void binary_Keypress()
+{
+    int data;
+
+    while((proto_port != uart_console || context == context_binary) &&
+          (data = UART_GetByte(proto_port)) >= 0)
+        PROTO_Feed(data);
+}
@@ -0,0 +1,85 @@
+/*==============================================================================
+  Header for the binary command protocol
+
+    Description
+    -----------
+    Compact framed protocol for streaming setpoints from a host. Entered
+    from the CLI with 'binary' and left with a PROTO_OP_EXIT frame. With
+    'binary <port>' the decoder runs on another USART instead, next to
+    the CLI, until it is moved back.
+
+        | SYNC | op | len | payload[len] | crc_lo | crc_hi |
+
+    SYNC is 0xA5. The CRC is CRC-16/CCITT [_crc_ccitt_update, init 0xFFFF]
+    over op, len and payload. Multi-byte values are little-endian. Every
+    request is answered with a frame; bad frames are dropped silently and
+    counted, since their opcode cannot be trusted.
+
+ =============================================================================*/
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include "uart.h"
+
+#define PROTO_SYNC 0xA5
+#define PROTO_MAX_PAYLOAD 48
+
+/* -------------------- */
+/*  Opcodes [requests]  */
+/* -------------------- */
+
+/* no payload -> ACK */
+#define PROTO_OP_PING   0x01
+/* n x {ch, counts[2]} absolute compare values [1 us with SERVO_PWM] -> ACK */
+#define PROTO_OP_SET    0x02
+/* n x {ch, level} coordinated move [MOTION_Move] -> ACK */
+#define PROTO_OP_MOVE   0x03
+/* [{start, count}] -> STATE for channels start .. start + count - 1;
+   no payload is start 0. count 0 or above PROTO_STATE_MAX is a full page */
+#define PROTO_OP_QUERY  0x10
+/* no payload -> ACK, then back to the CLI */
+#define PROTO_OP_EXIT   0x7F
+
+/* --------------------- */
+/*  Opcodes [responses]  */
+/* --------------------- */
+
+/* {op} */
+#define PROTO_OP_ACK    0x80
+/* {op, error} */
+#define PROTO_OP_NAK    0x81
+/* {start, channels, n x {target[2], position[2]}} compare values of
+   channels start .. start + n - 1, out of channels in the registry */
+#define PROTO_OP_STATE  0x90
+
+/* channels per STATE frame; the host pages through larger registries */
+#define PROTO_STATE_MAX ((PROTO_MAX_PAYLOAD - 2) / 4)
+
+/* NAK error codes */
+#define PROTO_ERR_OPCODE  1
+#define PROTO_ERR_LENGTH  2
+#define PROTO_ERR_CHANNEL 3
+
+/* frame counters [rxstat] */
+struct PROTO_COUNTERS {
+  uint16_t frames;
+  uint16_t crc_errors;
+  uint16_t length_errors;
+};
+
+extern struct PROTO_COUNTERS proto_count;
+
+// Reset the decoder and bind it to a port [call when entering binary mode]
+extern void PROTO_Init(UART *port);
+
+// Port the decoder is bound to
+extern UART * PROTO_Port(void);
+
+// Feed one received byte to the frame decoder
+extern void PROTO_Feed(uint8_t data);
+
+// Drain the bound port through the decoder [binary context handler]
+extern void binary_Keypress(void);
+
+#endif
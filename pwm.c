@@ -1,11 +1,12 @@
 /*==============================================================================
   Function declarations and data structures for 16 bit timers
  =============================================================================*/
-#include <stdio.h>
 #include "global.h"
 #include "timer.h"
 #include "pwm.h"
-#include <util/delay.h> 
+#include "sservo.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 
 /* ------------------ */
 /*  Extern variables  */
@@ -15,6 +16,10 @@
 /*  Static variables  */
 /* ------------------ */
 
+/* PWM object of each hardware timer, for its TOP interrupt */
+#define PWM_LATCH_IDX(n) ((n) == 1 ? 0 : (n) - 2)
+static PWM * pwm_latch[4];
+
 /* ---------------------- */
 /*  Function definitions  */
 /* ---------------------- */
@@ -37,11 +42,13 @@ void PWM_TimerConfig(
     uint16_t counter_max
 )
 {
-    /* copy in timer and register addresses */
+    /* copy in timer; compare values go through the shadow */
     pwm->timer = timer;
-    pwm->OCRnx[chn_A] = timer->OCRnA;
-    pwm->OCRnx[chn_B] = timer->OCRnB;
-    pwm->OCRnx[chn_C] = timer->OCRnC;
+    pwm->OCRnx[chn_A] = &pwm->pwm_shadow[chn_A];
+    pwm->OCRnx[chn_B] = &pwm->pwm_shadow[chn_B];
+    pwm->OCRnx[chn_C] = &pwm->pwm_shadow[chn_C];
+    pwm->pwm_seq = 0;
+    pwm->pwm_seq_latched = 0;
 
     /* Set to PWM mode [TCCRnA, TCCRnB] */
 
@@ -63,13 +70,13 @@ void PWM_TimerConfig(
 
     /* Clock source and prescalar [TCCRnB] */
     /*
-        prescalar     | CSn2:0       
-        --------------|--------------
-        1    = 0x0001 | 001  = 0x01  
-        8    = 0x0010 | 010  = 0x02  
-        64   = 0x0040 | 011  = 0x04  
-        256  = 0x0100 | 100  = 0x08  
-        1024 = 0x0400 | 101  = 0x10  
+        prescalar | CSn2:0
+        ----------|-------------
+        1         | 001  = 0x01
+        8         | 010  = 0x02
+        64        | 011  = 0x03
+        256       | 100  = 0x04
+        1024      | 101  = 0x05
     */
     set_1bit_hex(*(pwm->timer->TCCRnB), CSn2, prescalar);
     set_1bit_hex(*(pwm->timer->TCCRnB), CSn1, prescalar);
@@ -84,15 +91,15 @@ void PWM_TimerConfig(
         pwm->prescalar = 8;
         break;
 
-        case 4:
+        case 3:
         pwm->prescalar = 64;
         break;
 
-        case 8:
+        case 4:
         pwm->prescalar = 256;
         break;
 
-        case 16:
+        case 5:
         pwm->prescalar = 1024;
         break;
 
@@ -140,6 +147,31 @@ void PWM_TimerConfig(
 
    /* start from zero */
     *(pwm->timer->TCNTn) = 0x0000;
+
+    /* commit the shadow at TOP [ICFn in phase-freq correct mode] */
+    pwm_latch[PWM_LATCH_IDX(pwm->timer->timer_n)] = pwm;
+    switch(pwm->timer->timer_n)
+    {
+        case 1:
+        TIFR1 = (1 << ICF1);
+        sethigh_1bit(TIMSK1, ICIE1);
+        break;
+
+        case 3:
+        TIFR3 = (1 << ICF3);
+        sethigh_1bit(TIMSK3, ICIE3);
+        break;
+
+        case 4:
+        TIFR4 = (1 << ICF4);
+        sethigh_1bit(TIMSK4, ICIE4);
+        break;
+
+        case 5:
+        TIFR5 = (1 << ICF5);
+        sethigh_1bit(TIMSK5, ICIE5);
+        break;
+    }
 }
 
 /*# Set pwm configuration and initial state
@@ -159,7 +191,236 @@ void PWM_PwmConfig(PWM *pwm, uint16_t pwm_config[4], PWM_Channel chn_x)
     pwm->pwm_step[chn_x]       = pwm_config[3];
 
     pwm->pwm_level[chn_x] = pwm->pwm_level_idle[chn_x];
-    *(pwm->OCRnx[chn_x]) = pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x];
+    pwm->pwm_target[chn_x] = pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x];
+    PWM_ShadowOpen(pwm);
+    *(pwm->OCRnx[chn_x]) = pwm->pwm_target[chn_x];
+    PWM_ShadowClose(pwm);
+
+    /* start at rest on the idle level */
+    pwm->pwm_pos[chn_x] = (int32_t) pwm->pwm_target[chn_x] << 8;
+    pwm->pwm_vel[chn_x] = 0;
+    pwm->pwm_acc[chn_x] = 0;
+
+    PWM_ProfileConfig(
+        pwm, chn_x,
+        PWM_VEL_DEFAULT(pwm->pwm_step[chn_x]),
+        PWM_ACC_DEFAULT(pwm->pwm_step[chn_x]),
+        0
+    );
+}
+
+/*# Check limits against the PWM's period
+
+  min <= idle <= max, a non-zero step, and the compare value of the top
+  level no larger than TOP; anything above would hold the output high or
+  wrap the 16-bit level * step product.
+*/
+uint8_t PWM_LimitsValid(PWM *pwm, const uint16_t pwm_config[4])
+{
+    return pwm_config[3] != 0 &&
+           pwm_config[1] <= pwm_config[2] &&
+           pwm_config[2] <= pwm_config[0] &&
+           (uint32_t) pwm_config[0] * pwm_config[3] <= pwm->counter_max;
+}
+
+/*# Change limits of a running channel
+
+  Same layout as PWM_PwmConfig, but the channel is not reset: its level
+  is clamped to the new limits and the motion engine moves it to the
+  level's compare value. Limits failing PWM_LimitsValid are rejected.
+*/
+int PWM_SetLimits(PWM *pwm, const uint16_t pwm_config[4], PWM_Channel chn_x)
+{
+    uint16_t level = pwm->pwm_level[chn_x];
+
+    if(!PWM_LimitsValid(pwm, pwm_config))
+        return -1;
+
+    pwm->pwm_level_max[chn_x]  = pwm_config[0];
+    pwm->pwm_level_min[chn_x]  = pwm_config[1];
+    pwm->pwm_level_idle[chn_x] = pwm_config[2];
+    pwm->pwm_step[chn_x]       = pwm_config[3];
+
+    if(level > pwm_config[0]) level = pwm_config[0];
+    if(level < pwm_config[1]) level = pwm_config[1];
+    pwm->pwm_level[chn_x] = level;
+    PWM_SetTarget(pwm, chn_x, level * pwm_config[3]);
+    return 0;
+}
+
+/*# Set motion profile limits
+
+  Parameters
+  ----------
+  vel_max : compare counts per frame, 8.8 fixed-point [> 0]
+  acc_max : compare counts per frame^2, 8.8 fixed-point; 0 for no ramp
+  jerk_max: compare counts per frame^3, 8.8 fixed-point; 0 for trapezoid
+*/
+void PWM_ProfileConfig(
+    PWM *pwm,
+    PWM_Channel chn_x,
+    uint16_t vel_max,
+    uint16_t acc_max,
+    uint16_t jerk_max
+)
+{
+    /* velocity state is a signed 8.8 value */
+    if(vel_max > INT16_MAX) vel_max = INT16_MAX;
+    if(vel_max == 0) vel_max = 1;
+    if(acc_max > vel_max) acc_max = vel_max;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        pwm->pwm_vel_max[chn_x]  = vel_max;
+        pwm->pwm_acc_max[chn_x]  = acc_max;
+        pwm->pwm_jerk_max[chn_x] = jerk_max;
+
+        /* precomputed here so the frame interrupt never divides */
+        pwm->pwm_jerk_lead[chn_x] = (jerk_max == 0) ? 0 :
+            (acc_max / jerk_max > 255) ? 255 : acc_max / jerk_max;
+    }
+}
+
+/* # Set compare value the motion engine moves the channel towards
+
+  Returns immediately; OCRnx follows along the channel's motion profile.
+*/
+void PWM_SetTarget(PWM *pwm, PWM_Channel chn_x, uint16_t target)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        pwm->pwm_target[chn_x] = target;
+
+        /* a new target takes the channel out of any coordinated move */
+        pwm->pwm_sync &= ~(1 << chn_x);
+    }
+}
+
+/* # One frame of the velocity profile for a single channel
+
+  Integer-only so it is cheap enough for every channel, every frame. The
+  speed along the direction of the target is raised by the acceleration
+  until the remaining distance equals the braking distance, which is
+  tested without division:
+
+      v^2 + a*v*(1 + jerk_lead) >= 2*a*distance
+
+  With a jerk limit the applied acceleration itself slews towards the
+  requested one, giving S-curve edges. Returns the new compare value.
+*/
+static uint16_t PWM_Profile(PWM *pwm, uint8_t chn_x, uint16_t target)
+{
+    int32_t err = ((int32_t) target << 8) - pwm->pwm_pos[chn_x];
+    uint32_t dist = (err < 0) ? -err : err;
+    int16_t vel = (err < 0) ? -pwm->pwm_vel[chn_x] : pwm->pwm_vel[chn_x];
+    int16_t acc = (err < 0) ? -pwm->pwm_acc[chn_x] : pwm->pwm_acc[chn_x];
+    uint16_t acc_max = pwm->pwm_acc_max[chn_x];
+    uint16_t jerk_max = pwm->pwm_jerk_max[chn_x];
+    int16_t acc_cmd;
+
+    if(acc_max == 0)
+    {
+        /* no ramp: constant velocity */
+        vel = pwm->pwm_vel_max[chn_x];
+        acc = 0;
+    }
+    else
+    {
+        /* requested acceleration along the direction of the target */
+        if(vel <= 0)
+            acc_cmd = acc_max;
+        else if(((uint32_t) vel * vel >> 8) +
+                ((uint32_t) acc_max * vel >> 8) * (1 + pwm->pwm_jerk_lead[chn_x])
+                >= 2 * (uint32_t) acc_max * (dist >> 8))
+            acc_cmd = -acc_max;
+        else if(vel < pwm->pwm_vel_max[chn_x])
+            acc_cmd = acc_max;
+        else
+            acc_cmd = 0;
+
+        /* S-curve: slew the applied acceleration at jerk_max */
+        if(jerk_max == 0)
+            acc = acc_cmd;
+        else if((int32_t) acc_cmd > (int32_t) acc + jerk_max)
+            acc += jerk_max;
+        else if((int32_t) acc_cmd < (int32_t) acc - jerk_max)
+            acc -= jerk_max;
+        else
+            acc = acc_cmd;
+
+        vel += acc;
+        if(vel > (int16_t) pwm->pwm_vel_max[chn_x])
+        {
+            vel = pwm->pwm_vel_max[chn_x];
+            acc = 0;
+        }
+        /* keep creeping forward rather than stall just short of target */
+        else if(vel <= 0 && acc_cmd < 0)
+        {
+            vel = acc_max;
+            acc = 0;
+        }
+    }
+
+    /* arrive: snap onto the target and come to rest */
+    if(vel > 0 && (uint32_t) vel >= dist)
+    {
+        pwm->pwm_pos[chn_x] = (int32_t) target << 8;
+        pwm->pwm_vel[chn_x] = 0;
+        pwm->pwm_acc[chn_x] = 0;
+        return target;
+    }
+
+    /* store state back in absolute direction */
+    if(err < 0)
+    {
+        vel = -vel;
+        acc = -acc;
+    }
+    pwm->pwm_pos[chn_x] += vel;
+    pwm->pwm_vel[chn_x] = vel;
+    pwm->pwm_acc[chn_x] = acc;
+
+    /* round 8.8 position to the nearest compare count */
+    return (uint16_t) ((pwm->pwm_pos[chn_x] + 0x80) >> 8);
+}
+
+/* # One frame for a single channel
+
+  Inlined with constant chn_x, so state is reached at fixed offsets.
+  Returns non-zero while the channel is still moving.
+*/
+static inline __attribute__((always_inline))
+uint8_t PWM_UpdateChannel(PWM *pwm, uint8_t chn_x)
+{
+    uint16_t target;
+
+    /* driven by a coordinated move */
+    if(pwm->pwm_sync & (1 << chn_x))
+        return 1;
+
+    target = pwm->pwm_target[chn_x];
+
+    /* at rest on target */
+    if(pwm->pwm_vel[chn_x] == 0 &&
+       pwm->pwm_pos[chn_x] == ((int32_t) target << 8))
+        return 0;
+
+    *(pwm->OCRnx[chn_x]) = PWM_Profile(pwm, chn_x, target);
+    return 1;
+}
+
+/* # Advance all 3 channels one frame towards their targets
+
+  Called once per PWM frame from the motion engine's timer interrupt,
+  inside the frame's PWM_ShadowOpen / PWM_ShadowClose. Returns non-zero
+  while any channel is still moving.
+*/
+uint8_t PWM_Update(PWM *pwm)
+{
+    return PWM_UpdateChannel(pwm, chn_A) |
+           PWM_UpdateChannel(pwm, chn_B) |
+           PWM_UpdateChannel(pwm, chn_C);
 }
 
 /* # Increment duty cycle level */
@@ -167,8 +428,8 @@ int PWM_Inc(PWM *pwm, PWM_Channel chn_x)
 {
     if(pwm->pwm_level[chn_x] < pwm->pwm_level_max[chn_x])
     {
-        *(pwm->OCRnx[chn_x]) += pwm->pwm_step[chn_x];
         pwm->pwm_level[chn_x]++;
+        PWM_SetTarget(pwm, chn_x, pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x]);
     }
     return 0;
 }
@@ -178,54 +439,128 @@ int PWM_Dec(PWM *pwm, PWM_Channel chn_x)
 {
     if(pwm->pwm_level[chn_x] > pwm->pwm_level_min[chn_x])
     {
-        *(pwm->OCRnx[chn_x]) -= pwm->pwm_step[chn_x];
         pwm->pwm_level[chn_x]--;
+        PWM_SetTarget(pwm, chn_x, pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x]);
     }
     return 0;
 }
 
-/* # Calculate and return duty cycle of given PWM */
-int PWM_FrequencyHz(PWM *pwm, char *str_out)
+/* # Pulse width of the channel's target in microseconds
+
+  High for OCRnx counts on the way up and again on the way down, so
+  pulse = 2 * OCRnx * prescalar / F_CPU.
+*/
+uint16_t PWM_PulseUs(PWM *pwm, PWM_Channel chn_x)
 {
-    uint8_t denom = 2 * pwm->counter_max * pwm->prescalar;
-    if(denom <= 0)
-        return -1;
-    else
-    {
-        uint8_t freq_hz = (F_CPU - (F_CPU % denom)) / denom;
-        return sprintf(str_out, "%d Hz", freq_hz);
-    }
+    return ((uint32_t) pwm->pwm_target[chn_x] * 2 * pwm->prescalar) /
+           (F_CPU / 1000000UL);
 }
 
-/* # Calculate and return duty cycle of given PWM */
-int PWM_DutyCycle(PWM *pwm, PWM_Channel chn_x, char *str_out)
+/* # Pulse width of a level of the channel in microseconds */
+uint16_t PWM_LevelUs(PWM *pwm, PWM_Channel chn_x, uint16_t level)
 {
-    if(*(pwm->OCRnx[chn_x]) > pwm->counter_max)
-        return -1;
-    else
-    {
-        uint8_t mod = (100 * pwm->counter_max) % *(pwm->OCRnx[chn_x]);
-        uint8_t out = ((100 * pwm->counter_max) - mod) / *(pwm->OCRnx[chn_x]);
-        return sprintf(str_out, "%d %%", out);
-    }
+    return ((uint32_t) level * pwm->pwm_step[chn_x] * 2 * pwm->prescalar) /
+           (F_CPU / 1000000UL);
+}
+
+/* # Move the channel to a pulse width in microseconds
+
+  Clamped to the channel's level limits. The level view follows as the
+  nearest level; the target keeps the full resolution [1 us with the
+  SERVO_PWM preset].
+*/
+void PWM_SetPulseUs(PWM *pwm, PWM_Channel chn_x, uint16_t us)
+{
+    uint16_t step = pwm->pwm_step[chn_x];
+    uint32_t counts, lo, hi;
+
+    if(pwm->prescalar == 0)
+        return;
+
+    counts = ((uint32_t) us * (F_CPU / 1000000UL)) / (2 * pwm->prescalar);
+    lo = (uint32_t) pwm->pwm_level_min[chn_x] * step;
+    hi = (uint32_t) pwm->pwm_level_max[chn_x] * step;
+    if(counts < lo) counts = lo;
+    if(counts > hi) counts = hi;
+
+    pwm->pwm_level[chn_x] = (counts + step / 2) / step;
+    PWM_SetTarget(pwm, chn_x, counts);
+}
+
+/* # PWM frequency in Hz, 24.8 fixed-point
+
+  Phase and frequency correct mode counts up to TOP and back down, so
+  f = F_CPU / (2 * prescalar * TOP). Returns 0 if the timer is unset.
+*/
+uint32_t PWM_FrequencyHz(PWM *pwm)
+{
+    uint32_t denom = 2UL * pwm->counter_max * pwm->prescalar;
+
+    if(denom == 0)
+        return 0;
+
+    /* F_CPU << 8 still fits in 32 bits up to 16.7 MHz */
+    return (((uint32_t) F_CPU << 8) + denom / 2) / denom;
+}
+
+/* # Duty cycle of given channel in percent, 8.8 fixed-point
+
+  The output is high for OCRnx of every TOP counts on the way up and
+  down, so duty = 100 * OCRnx / TOP.
+*/
+uint16_t PWM_DutyCycle(PWM *pwm, PWM_Channel chn_x)
+{
+    uint16_t ocr = *(pwm->OCRnx[chn_x]);
+
+    if(pwm->counter_max == 0)
+        return 0;
+    if(ocr >= pwm->counter_max)
+        return 100 << 8;
+
+    return ((uint32_t) ocr * (100 << 8)) / pwm->counter_max;
 }
 
 /* # Set level back to idle
+
+  Non-blocking; the motion engine ramps the channel back along its profile.
 */
 int PWM_Idle(PWM * pwm, PWM_Channel chn_x)
 {
-    while(pwm->pwm_level[chn_x] < pwm->pwm_level_idle[chn_x])
-    {
-        _delay_ms(25);
-        *(pwm->OCRnx[chn_x]) += pwm->pwm_step[chn_x];
-        pwm->pwm_level[chn_x]++;
-    }
-    while(pwm->pwm_level[chn_x] > pwm->pwm_level_idle[chn_x])
-    {
-        _delay_ms(25);
-        *(pwm->OCRnx[chn_x]) -= pwm->pwm_step[chn_x];
-        pwm->pwm_level[chn_x]--;
-    }
+    pwm->pwm_level[chn_x] = pwm->pwm_level_idle[chn_x];
+    PWM_SetTarget(pwm, chn_x, pwm->pwm_level[chn_x] * pwm->pwm_step[chn_x]);
     return 0;
 }
 
+/* ------------------------ */
+/*  TOP interrupt handlers  */
+/* ------------------------ */
+
+/* # Commit a closed, new shadow to all 3 compare registers
+
+  Runs at TOP, half a frame before the hardware copies OCRnx from its
+  buffer at BOTTOM, so the three channels always change in the same
+  frame. Register addresses are compile-time constants [sts].
+*/
+#define _PWM_LATCH_VECTOR(n) \
+    ISR(TIMER##n##_CAPT_vect) \
+    { \
+        PWM *pwm = pwm_latch[PWM_LATCH_IDX(n)]; \
+        uint8_t seq = pwm->pwm_seq; \
+        if((seq & 1) || seq == pwm->pwm_seq_latched) return; \
+        TIMER_OCR(n, chn_A) = pwm->pwm_shadow[chn_A]; \
+        TIMER_OCR(n, chn_B) = pwm->pwm_shadow[chn_B]; \
+        TIMER_OCR(n, chn_C) = pwm->pwm_shadow[chn_C]; \
+        pwm->pwm_seq_latched = seq; \
+    }
+
+/* not for the timer given to the software servo driver */
+_PWM_LATCH_VECTOR(1)
+#if SSERVO_TIMER != 3
+_PWM_LATCH_VECTOR(3)
+#endif
+#if SSERVO_TIMER != 4
+_PWM_LATCH_VECTOR(4)
+#endif
+#if SSERVO_TIMER != 5
+_PWM_LATCH_VECTOR(5)
+#endif
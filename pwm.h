@@ -35,20 +35,71 @@ typedef struct PWM
     /* min, max values of pwm configured oscillator-counter */
     uint16_t counter_max;
 
-    /* pointers to compare registers; controls the duty cycle */
+    /* compare values; controls the duty cycle. For a hardware timer these
+       point at pwm_shadow, which the timer's TOP interrupt commits */
     volatile uint16_t * OCRnx[3];
 
+    /* compare values waiting for TOP; written between PWM_ShadowOpen and
+       PWM_ShadowClose */
+    volatile uint16_t pwm_shadow[3];
+
+    /* odd while the shadow is being written; the TOP interrupt skips an
+       open shadow and one it has already committed */
+    volatile uint8_t pwm_seq;
+    uint8_t pwm_seq_latched;
+
     /* state variables for pwm's; level proportional to duty cycle */
     uint16_t pwm_level[3];
 
-    /* constraints to pwm levels */
+    /* constraints to pwm levels; a level is a view over the compare value,
+       level * pwm_step */
     uint16_t pwm_level_max[3];
     uint16_t pwm_level_min[3];
     uint16_t pwm_level_idle[3];
     uint16_t pwm_step[3];
 
+    /* compare value the motion engine is moving OCRnx towards */
+    volatile uint16_t pwm_target[3];
+
+    /* motion profile limits in 8.8 fixed-point compare counts;
+       velocity per frame, acceleration per frame^2, jerk per frame^3.
+       acc 0 moves at constant velocity, jerk 0 gives a trapezoid */
+    uint16_t pwm_vel_max[3];
+    uint16_t pwm_acc_max[3];
+    uint16_t pwm_jerk_max[3];
+
+    /* frames needed to ramp acceleration to pwm_acc_max at pwm_jerk_max */
+    uint8_t pwm_jerk_lead[3];
+
+    /* profile state [8.8 fixed-point]; owned by the frame interrupt */
+    int32_t pwm_pos[3];
+    int16_t pwm_vel[3];
+    int16_t pwm_acc[3];
+
+    /* bit per channel; set while a coordinated move drives the channel */
+    volatile uint8_t pwm_sync;
+
 } PWM;
 
+/* # Bracket writes to a PWM's compare values
+
+   Lock-free for the writer; the TOP interrupt only ever reads pwm_seq, so
+   all writes between open and close reach the outputs in one frame.
+*/
+static inline void PWM_ShadowOpen(PWM *pwm)
+{
+    pwm->pwm_seq++;
+}
+
+static inline void PWM_ShadowClose(PWM *pwm)
+{
+    pwm->pwm_seq++;
+}
+
+/* default profile: 2 levels / frame, full speed after 8 frames */
+#define PWM_VEL_DEFAULT(step) ((step) << 9)
+#define PWM_ACC_DEFAULT(step) ((step) << 6)
+
 // Set timer configuration
 extern void PWM_TimerConfig(
     PWM* pwm,
@@ -61,6 +112,13 @@ extern void PWM_TimerConfig(
 // Set pwm configuration and initial state
 extern void PWM_PwmConfig(PWM * pwm, uint16_t pwn_config[4], PWM_Channel chn_x);
 
+// TRUE if limits [PWM_PwmConfig order] fit the PWM's period
+extern uint8_t PWM_LimitsValid(PWM * pwm, const uint16_t pwm_config[4]);
+
+// Change limits of a running channel; its level is kept within them.
+// -1 if they do not fit [PWM_LimitsValid]
+extern int PWM_SetLimits(PWM * pwm, const uint16_t pwm_config[4], PWM_Channel chn_x);
+
 // Constructor
 extern int PWM_Init(PWM * pwm, TIMER * timer);
 
@@ -73,11 +131,36 @@ extern int PWM_Dec(PWM * pwm, PWM_Channel chn_x);
 // Set level back to idle
 extern int PWM_Idle(PWM * pwm, PWM_Channel chn_x);
 
-// Calculate and return duty cycle of given PWM
-extern int PWM_FrequencyHz(PWM * pwm, char *str_out);
+// Set velocity / acceleration / jerk limits [8.8 fixed-point counts]
+extern void PWM_ProfileConfig(
+    PWM * pwm,
+    PWM_Channel chn_x,
+    uint16_t vel_max,
+    uint16_t acc_max,
+    uint16_t jerk_max
+);
+
+// Set compare value the motion engine moves the channel towards
+extern void PWM_SetTarget(PWM * pwm, PWM_Channel chn_x, uint16_t target);
+
+// Pulse width of the channel's target in microseconds
+extern uint16_t PWM_PulseUs(PWM * pwm, PWM_Channel chn_x);
+
+// Pulse width of a level of the channel in microseconds
+extern uint16_t PWM_LevelUs(PWM * pwm, PWM_Channel chn_x, uint16_t level);
+
+// Move the channel to a pulse width in microseconds [clamped to its limits]
+extern void PWM_SetPulseUs(PWM * pwm, PWM_Channel chn_x, uint16_t us);
+
+// Advance all 3 channels one frame towards their targets [ISR context;
+// between PWM_ShadowOpen and PWM_ShadowClose]
+extern uint8_t PWM_Update(PWM * pwm);
+
+// PWM frequency in Hz [24.8 fixed-point]
+extern uint32_t PWM_FrequencyHz(PWM * pwm);
 
-// Calculate and return duty cycle of given PWM
-extern int PWM_DutyCycle(PWM * pwm, PWM_Channel x, char *str_out);
+// Duty cycle of given channel in percent [8.8 fixed-point]
+extern uint16_t PWM_DutyCycle(PWM * pwm, PWM_Channel x);
 
 /* future todo's */
 
@@ -87,7 +170,11 @@ extern int PWM_DutyCycle(PWM * pwm, PWM_Channel x, char *str_out);
 // // Returns string formatted configuration of PWMs
 // extern int PWM_ConfigReport(PWM * pwm, char *str_out);
 
-/* preset for 20Hz servo app [prescalar, uninverted, max_count] */
-#define SERVO_PWM 0x04, 0, 0x271
+/* preset for 50Hz servo app [prescalar /8 (CSn2:0), uninverted, max_count];
+   0.5 us per timer count, so one compare count is 1 us of pulse */
+#define SERVO_PRESCALAR 0x02
+#define SERVO_PRESCALE_DIV 8
+#define SERVO_TOP 20000
+#define SERVO_PWM SERVO_PRESCALAR, 0, SERVO_TOP
 
 #endif
\ No newline at end of file
@@ -0,0 +1,276 @@
+/*==============================================================================
+  Function declarations and data structures for the motion recorder
+ =============================================================================*/
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include "global.h"
+#include "pwm.h"
+#include "motion.h"
+#include "record.h"
+#include "macro.h"
+
+/* identifies a stored recording; changes with the layout */
+#define RECORD_MAGIC 0x5231
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* stored ahead of the events */
+typedef struct RECORD_HEADER
+{
+    uint16_t magic;
+    uint16_t len;
+    uint8_t n_channels;
+    uint16_t start[MOTION_MAX_CHANNELS];
+} RECORD_HEADER;
+
+_Static_assert(RECORD_EE_ADDR + sizeof(RECORD_HEADER) + RECORD_SIZE <= MACRO_EE_ADDR,
+               "recording overlaps the macros");
+
+static RECORD_HEADER record_hdr;
+static uint8_t record_buf[RECORD_SIZE];
+
+static volatile RECORD_State record_state;
+
+/* capture: frame of the previous event */
+static uint16_t record_last;
+
+/* playback */
+static uint16_t record_pos;
+static uint16_t record_frame;
+static uint16_t record_rate;
+static uint32_t record_clock;
+static uint32_t record_due;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Load the recording from EEPROM
+
+   An empty or foreign EEPROM leaves no recording.
+*/
+void RECORD_Init()
+{
+    record_state = record_idle;
+
+    eeprom_read_block(&record_hdr, (const void *) RECORD_EE_ADDR,
+                      sizeof(record_hdr));
+
+    if(record_hdr.magic != RECORD_MAGIC || record_hdr.len > RECORD_SIZE ||
+       record_hdr.n_channels > MOTION_MAX_CHANNELS)
+    {
+        record_hdr.len = 0;
+        record_hdr.n_channels = 0;
+        return;
+    }
+
+    eeprom_read_block(record_buf,
+                      (const void *) (RECORD_EE_ADDR + sizeof(record_hdr)),
+                      record_hdr.len);
+}
+
+/* # Snapshot all levels and capture level changes from now on */
+void RECORD_Start()
+{
+    PWM *pwm;
+    PWM_Channel chn_x;
+    uint8_t ch;
+
+    RECORD_Stop();
+
+    record_hdr.n_channels = MOTION_Channels();
+    for(ch = 0; ch < record_hdr.n_channels; ch++)
+    {
+        pwm = MOTION_Channel(ch, &chn_x);
+        record_hdr.start[ch] = pwm->pwm_level[chn_x];
+    }
+    record_hdr.len = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        record_last = motion_frame;
+    }
+    record_state = record_capture;
+}
+
+/* # End a capture or a playback
+
+   A capture is written to EEPROM; only bytes that changed are programmed,
+   at about 3.3 ms each, with interrupts left running.
+*/
+void RECORD_Stop()
+{
+    RECORD_State state = record_state;
+
+    record_state = record_idle;
+    if(state != record_capture) return;
+
+    record_hdr.magic = RECORD_MAGIC;
+    eeprom_update_block(&record_hdr, (void *) RECORD_EE_ADDR,
+                        sizeof(record_hdr));
+    eeprom_update_block(record_buf,
+                        (void *) (RECORD_EE_ADDR + sizeof(record_hdr)),
+                        record_hdr.len);
+}
+
+/* # Note a level change
+
+   Called for every MOTION_Inc / MOTION_Dec; ignored unless capturing. A
+   full buffer drops further events.
+*/
+void RECORD_Event(uint8_t ch, int8_t dir)
+{
+    uint16_t now, delta;
+
+    if(record_state != record_capture) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = motion_frame;
+    }
+    delta = now - record_last;
+
+    /* gap bytes plus the event itself */
+    if(record_hdr.len + delta / RECORD_GAP + 2 > RECORD_SIZE)
+        return;
+
+    while(delta >= RECORD_GAP)
+    {
+        record_buf[record_hdr.len++] = RECORD_GAP;
+        delta -= RECORD_GAP;
+    }
+    record_buf[record_hdr.len++] = delta;
+    record_buf[record_hdr.len++] = ch | ((dir > 0) ? 0x80 : 0);
+
+    record_last = now;
+}
+
+/* # Frame of the event at record_pos; FALSE past the last event */
+static uint8_t RECORD_Next()
+{
+    while(record_pos < record_hdr.len && record_buf[record_pos] == RECORD_GAP)
+    {
+        record_due += RECORD_GAP;
+        record_pos++;
+    }
+    if(record_pos + 2 > record_hdr.len)
+        return FALSE;
+
+    record_due += record_buf[record_pos++];
+    return TRUE;
+}
+
+/* # Play the recording back
+
+   rate is 8.8 fixed-point [RECORD_RATE_1X plays at the recorded speed].
+   Returns -1 if there is no recording or it was made with a different
+   set of channels.
+*/
+int RECORD_Play(uint16_t rate)
+{
+    uint8_t mask[MOTION_MASK_BYTES] = {0};
+    uint8_t ch;
+
+    RECORD_Stop();
+
+    if(record_hdr.n_channels == 0 ||
+       record_hdr.n_channels != MOTION_Channels() || rate == 0)
+        return -1;
+
+    for(ch = 0; ch < record_hdr.n_channels; ch++)
+        MOTION_MASK_SET(mask, ch);
+    MOTION_Move(mask, record_hdr.start);
+
+    record_rate = rate;
+    record_pos = 0;
+    record_clock = 0;
+    record_due = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        record_frame = motion_frame;
+    }
+    record_state = record_seek;
+    return 0;
+}
+
+/* # Advance playback to the current frame
+
+   Task context, on the frame event. The clock advances by the frames
+   counted since the last run, so a late run catches up instead of
+   drifting. Steps are applied on the first frame whose scaled clock
+   reaches their stamp.
+*/
+void RECORD_Poll()
+{
+    uint16_t now, elapsed;
+    uint8_t event;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = motion_frame;
+    }
+
+    switch(record_state)
+    {
+        /* wait for the start pose; the busy flag is stale until the
+           first frame after MOTION_Move */
+        case record_seek:
+            if(now == record_frame || MOTION_Busy()) return;
+            record_frame = now;
+            record_state = RECORD_Next() ? record_play : record_idle;
+        return;
+
+        case record_play:
+            elapsed = now - record_frame;
+            record_frame = now;
+            record_clock += (uint32_t) elapsed * record_rate;
+            while((record_due << 8) <= record_clock)
+            {
+                event = record_buf[record_pos++];
+                if(event & 0x80)
+                    MOTION_Inc(event & 0x7F);
+                else
+                    MOTION_Dec(event & 0x7F);
+
+                if(!RECORD_Next())
+                {
+                    record_state = record_idle;
+                    return;
+                }
+            }
+        return;
+
+        default:
+        return;
+    }
+}
+
+RECORD_State RECORD_GetState()
+{
+    return record_state;
+}
+
+/* # Bytes of events held */
+uint16_t RECORD_Length()
+{
+    return record_hdr.len;
+}
+
+/* # Frames from the start of the recording to its last event */
+uint32_t RECORD_Frames()
+{
+    uint32_t frames = 0;
+    uint16_t i;
+
+    for(i = 0; i < record_hdr.len; i++)
+    {
+        if(record_buf[i] == RECORD_GAP)
+            frames += RECORD_GAP;
+        else
+            frames += record_buf[i++];
+    }
+    return frames;
+}
@@ -0,0 +1,72 @@
+/*==============================================================================
+  Header for the motion recorder
+
+    Description
+    -----------
+    Captures level changes made through MOTION_Inc / MOTION_Dec, stamped
+    with the motion engine's frame counter, and plays them back from a
+    task run on every frame event [RECORD_Poll]. Playback needs nothing
+    from the serial link and lands every step on the frame it was recorded
+    on [scaled by the rate]; the levels stay with the main loop, so the
+    frame interrupt never races a command for them.
+
+    A recording starts with a snapshot of every channel's level; playback
+    first moves all channels there [MOTION_Move] and starts the clock once
+    they have arrived, so runs are reproducible.
+
+    Events are delta-encoded, two bytes each:
+
+        [frames since the previous event] [channel | dir << 7]
+
+    A delta byte of RECORD_GAP adds 255 frames and carries no event. The
+    recording is kept in EEPROM at RECORD_EE_ADDR and survives a reset.
+
+ =============================================================================*/
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include "motion.h"
+
+/* RAM / EEPROM space for events [bytes] */
+#ifndef RECORD_SIZE
+#define RECORD_SIZE 512
+#endif
+
+/* EEPROM location of the recording; the space below is left for
+   configuration */
+#define RECORD_EE_ADDR 0x300
+
+/* delta byte: 255 frames and no event */
+#define RECORD_GAP 0xFF
+
+/* playback rate of the original recording [8.8 fixed-point] */
+#define RECORD_RATE_1X 0x0100
+
+typedef enum {record_idle, record_capture, record_seek, record_play} RECORD_State;
+
+// Load the recording from EEPROM
+extern void RECORD_Init(void);
+
+// Snapshot all levels and capture level changes from now on
+extern void RECORD_Start(void);
+
+// End a capture [and save it to EEPROM] or a playback
+extern void RECORD_Stop(void);
+
+// Play the recording back at rate [8.8 fixed-point]; -1 if none fits
+extern int RECORD_Play(uint16_t rate);
+
+// Note a level change of channel ch [+1 / -1]; MOTION_Inc / MOTION_Dec
+extern void RECORD_Event(uint8_t ch, int8_t dir);
+
+// Advance playback to the current frame [task on EVENT_FRAME]
+extern void RECORD_Poll(void);
+
+extern RECORD_State RECORD_GetState(void);
+
+// Bytes of events held, and frames covered by them
+extern uint16_t RECORD_Length(void);
+extern uint32_t RECORD_Frames(void);
+
+#endif
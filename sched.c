@@ -0,0 +1,202 @@
+/*==============================================================================
+  Function declarations and data structures for the task scheduler
+ =============================================================================*/
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "global.h"
+#include "uart.h"
+#include "tick.h"
+#include "sched.h"
+
+/* task flags */
+#define SCHED_USED  0x01
+#define SCHED_READY 0x02
+#define SCHED_TIMED 0x04
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+typedef struct SCHED_TASK
+{
+    SCHED_Task task;
+
+    /* PROGMEM name */
+    const char * name;
+
+    uint8_t prio;
+    uint8_t flags;
+
+    /* events that make the task ready */
+    uint8_t events;
+
+    /* ms; due is the next release if SCHED_TIMED */
+    uint16_t period;
+    uint32_t due;
+
+    /* statistics */
+    uint16_t runs;
+    uint16_t overruns;
+    uint16_t max_us;
+} SCHED_TASK;
+
+static SCHED_TASK sched_task[SCHED_MAX_TASKS];
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Add a task
+
+   Periodic with period ms [first run one period from now] if period is
+   non-zero, and made ready by any of events. Returns the id or -1.
+*/
+int8_t SCHED_Add(SCHED_Task task, const char *name, uint8_t prio,
+                 uint16_t period, uint8_t events)
+{
+    SCHED_TASK *t;
+    int8_t id;
+
+    for(id = 0; id < SCHED_MAX_TASKS; id++)
+        if(!(sched_task[id].flags & SCHED_USED)) break;
+    if(id == SCHED_MAX_TASKS)
+        return -1;
+
+    t = &sched_task[id];
+    t->task = task;
+    t->name = name;
+    t->prio = prio;
+    t->events = events;
+    t->period = period;
+    t->due = TICK_Ms() + period;
+    t->runs = 0;
+    t->overruns = 0;
+    t->max_us = 0;
+    t->flags = SCHED_USED | (period ? SCHED_TIMED : 0);
+    return id;
+}
+
+/* # Make a task ready now; for tasks or main-loop code, not interrupts */
+void SCHED_Trigger(int8_t id)
+{
+    if(id >= 0 && id < SCHED_MAX_TASKS)
+        sched_task[id].flags |= SCHED_READY;
+}
+
+/* # Account for the release of a timed task starting at now
+
+   A periodic task that starts a whole period late has overrun; it is
+   moved onto now instead of running the missed releases back to back.
+*/
+static void SCHED_Release(SCHED_TASK *t, uint32_t now)
+{
+    if(now - t->due >= t->period)
+    {
+        t->overruns++;
+        t->due = now + t->period;
+    }
+    else
+        t->due += t->period;
+}
+
+/* # Run tasks forever
+
+   Each pass takes the pending events, picks the first ready task of the
+   best priority and runs it. With none ready it sleeps until one of the
+   tasks' events, or the tick on which the next timed task is due.
+*/
+void SCHED_Run()
+{
+    SCHED_TASK *t, *best;
+    uint32_t now, wake, t0, us;
+    uint8_t ev, mask, id;
+
+    while(1)
+    {
+        mask = 0;
+        for(id = 0; id < SCHED_MAX_TASKS; id++)
+        {
+            t = &sched_task[id];
+            if(!(t->flags & SCHED_USED)) continue;
+            mask |= t->events;
+            if(t->flags & SCHED_TIMED) mask |= EVENT_TICK;
+        }
+
+        cli();
+        ev = events & mask;
+        events &= ~ev;
+        sei();
+
+        now = TICK_Ms();
+        wake = now + 0x7FFFFFFF;
+        best = NULL;
+        for(id = 0; id < SCHED_MAX_TASKS; id++)
+        {
+            t = &sched_task[id];
+            if(!(t->flags & SCHED_USED)) continue;
+
+            if((t->flags & SCHED_TIMED) && (int32_t) (t->due - wake) < 0)
+                wake = t->due;
+
+            if((ev & t->events) ||
+               ((t->flags & SCHED_TIMED) && (int32_t) (now - t->due) >= 0))
+                t->flags |= SCHED_READY;
+
+            if((t->flags & SCHED_READY) && (best == NULL || t->prio < best->prio))
+                best = t;
+        }
+
+        if(best == NULL)
+        {
+            if(mask & EVENT_TICK) TICK_WakeAt(wake);
+            TICK_Idle(mask);
+            continue;
+        }
+
+        /* released by its period, or by an event / trigger in between */
+        best->flags &= ~SCHED_READY;
+        if((best->flags & SCHED_TIMED) && (int32_t) (now - best->due) >= 0)
+            SCHED_Release(best, now);
+
+        t0 = TICK_Us();
+        best->task();
+        us = TICK_Us() - t0;
+
+        best->runs++;
+        if(us > best->max_us)
+            best->max_us = (us > 0xFFFF) ? 0xFFFF : us;
+        if(best->period && us > (uint32_t) best->period * 1000)
+            best->overruns++;
+    }
+}
+
+/* # Print every task with its statistics */
+void SCHED_List()
+{
+    SCHED_TASK *t;
+    uint8_t id;
+
+    uart_SendString_P(PSTR("id prio period runs overruns max_us name\n\r"));
+    for(id = 0; id < SCHED_MAX_TASKS; id++)
+    {
+        t = &sched_task[id];
+        if(!(t->flags & SCHED_USED)) continue;
+
+        uart_SendUInt(id);
+        uart_SendByte(' ');
+        uart_SendUInt(t->prio);
+        uart_SendByte(' ');
+        uart_SendUInt(t->period);
+        uart_SendByte(' ');
+        uart_SendUInt(t->runs);
+        uart_SendByte(' ');
+        uart_SendUInt(t->overruns);
+        uart_SendByte(' ');
+        uart_SendUInt(t->max_us);
+        uart_SendByte(' ');
+        uart_SendString_P(t->name);
+        uart_SendString_P(PSTR("\n\r"));
+    }
+}
@@ -0,0 +1,46 @@
+/*==============================================================================
+  Header for the task scheduler
+
+    Description
+    -----------
+    Run-to-completion tasks on the 1 ms system tick [tick.h]. A task is
+    made ready by its period coming due, by one of its events [EVENT_*,
+    set by interrupts] or by SCHED_Trigger. Of the ready tasks the one
+    with the lowest priority value runs next, ties in the order they were
+    added; nothing is preempted, so tasks should return quickly. With no
+    task ready the CPU sleeps [TICK_Idle].
+
+    A periodic task keeps its phase. It overruns when it starts a whole
+    period late or runs for longer than its period; overruns are counted
+    per task along with runs and the longest run time.
+
+ =============================================================================*/
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS 8
+
+/* priorities; lower runs first */
+#define SCHED_PRIO_HIGH 0
+#define SCHED_PRIO_NORMAL 1
+#define SCHED_PRIO_LOW 2
+
+typedef void (*SCHED_Task)(void);
+
+// Add a task, periodic every period ms [0: not timed] and/or run on
+// events; returns its id or -1 if the table is full
+extern int8_t SCHED_Add(SCHED_Task task, const char *name, uint8_t prio,
+                        uint16_t period, uint8_t events);
+
+// Make a task ready now
+extern void SCHED_Trigger(int8_t id);
+
+// Run tasks forever
+extern void SCHED_Run(void);
+
+// Print every task with its statistics to the console
+extern void SCHED_List(void);
+
+#endif
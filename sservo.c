@@ -0,0 +1,307 @@
+/*==============================================================================
+  Function declarations and data structures for the software servo driver
+ =============================================================================*/
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "global.h"
+#include "timer.h"
+#include "pwm.h"
+#include "sservo.h"
+
+#if SSERVO_TIMER
+
+/* registers and vector of the driver's timer */
+#define _SSERVO_CAT(a, n, b) a##n##b
+#define SSERVO_CAT(a, n, b) _SSERVO_CAT(a, n, b)
+
+#define SSERVO_TIMSK  SSERVO_CAT(TIMSK, SSERVO_TIMER, )
+#define SSERVO_TIFR   SSERVO_CAT(TIFR, SSERVO_TIMER, )
+#define SSERVO_OCIEA  SSERVO_CAT(OCIE, SSERVO_TIMER, A)
+#define SSERVO_OCFA   SSERVO_CAT(OCF, SSERVO_TIMER, A)
+#define SSERVO_VECT   SSERVO_CAT(TIMER, SSERVO_TIMER, _COMPA_vect)
+#define SSERVO_OCRA   TIMER_OCR(SSERVO_TIMER, chn_A)
+#define SSERVO_TCNT   TIMER_TCNT(SSERVO_TIMER)
+
+/* slots holding at least one channel */
+#define SSERVO_USED_SLOTS ((SSERVO_CHANNELS + SSERVO_BANK - 1) / SSERVO_BANK)
+
+/* sservo_edge value: the slot start is due next */
+#define SSERVO_SLOT_START 0xFF
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* pins set [rise] or cleared [fall, time ticks after the rise] together */
+typedef struct SSERVO_EDGE
+{
+    volatile uint8_t * port;
+    uint8_t mask;
+    uint16_t time;
+} SSERVO_EDGE;
+
+/* one bank: a rise per port, falls sorted by time */
+typedef struct SSERVO_SLOT
+{
+    uint8_t n_rise;
+    uint8_t n_fall;
+    SSERVO_EDGE rise[SSERVO_BANK];
+    SSERVO_EDGE fall[SSERVO_BANK];
+} SSERVO_SLOT;
+
+/* pin table [PROGMEM] */
+static const SSERVO_PIN * sservo_pins;
+
+/* setpoints in hardware compare counts; the PWM objects' OCRnx */
+static volatile uint16_t sservo_count[SSERVO_CHANNELS];
+
+/* setpoints the newest schedule was built from */
+static uint16_t sservo_built[SSERVO_CHANNELS];
+
+/* channels of each bank, sorted by width */
+static uint8_t sservo_order[SSERVO_USED_SLOTS][SSERVO_BANK];
+
+/* double-buffered schedule; the interrupt reads sservo_front */
+static SSERVO_SLOT sservo_sched[2][SSERVO_USED_SLOTS];
+static volatile uint8_t sservo_front;
+static volatile uint8_t sservo_pending;
+
+/* interrupt state */
+static uint8_t sservo_slot;
+static uint8_t sservo_edge;
+static uint16_t sservo_start;
+static uint16_t sservo_t0;
+
+/* stands in for the hardware timer of a PWM object [timer_n 0] */
+static TIMER sservo_timer;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Rebuild the schedule of one bank
+
+   The bank's order is still sorted for the previous widths and only a few
+   channels move per frame, so the insertion sort is O(n) in practice.
+*/
+static void SSERVO_BuildSlot(SSERVO_SLOT *slot, uint8_t s)
+{
+    uint8_t *order = sservo_order[s];
+    uint8_t n = SSERVO_CHANNELS - s * SSERVO_BANK;
+    volatile uint8_t *port;
+    uint8_t i, j, ch, mask;
+    uint32_t ticks;
+
+    if(n > SSERVO_BANK) n = SSERVO_BANK;
+
+    for(i = 1; i < n; i++)
+    {
+        ch = order[i];
+        for(j = i; j > 0 && sservo_built[order[j - 1]] > sservo_built[ch]; j--)
+            order[j] = order[j - 1];
+        order[j] = ch;
+    }
+
+    slot->n_rise = 0;
+    slot->n_fall = 0;
+
+    for(i = 0; i < n; i++)
+    {
+        ch = order[i];
+
+        /* off; the pin stays low */
+        if(sservo_built[ch] == 0) continue;
+
+        port = (volatile uint8_t *) pgm_read_ptr(&sservo_pins[ch].port);
+        mask = pgm_read_byte(&sservo_pins[ch].mask);
+
+        ticks = (uint32_t) sservo_built[ch] * SSERVO_TICKS_PER_COUNT;
+        if(ticks > SSERVO_SLOT_TICKS - SSERVO_GUARD)
+            ticks = SSERVO_SLOT_TICKS - SSERVO_GUARD;
+
+        /* one rise per port */
+        for(j = 0; j < slot->n_rise && slot->rise[j].port != port; j++)
+        ;
+        if(j == slot->n_rise)
+        {
+            slot->rise[j].port = port;
+            slot->rise[j].mask = 0;
+            slot->n_rise++;
+        }
+        slot->rise[j].mask |= mask;
+
+        /* equal widths on the same port share a fall */
+        j = slot->n_fall;
+        if(j > 0 && slot->fall[j - 1].time == ticks &&
+           slot->fall[j - 1].port == port)
+        {
+            slot->fall[j - 1].mask |= mask;
+            continue;
+        }
+        slot->fall[j].port = port;
+        slot->fall[j].mask = mask;
+        slot->fall[j].time = ticks;
+        slot->n_fall++;
+    }
+}
+
+/* # Rebuild the schedule if a setpoint changed
+
+   Frame interrupt context, after the PWM objects were updated. The new
+   schedule goes to the back buffer and is taken over by the interrupt at
+   the next frame start; until then further changes wait.
+*/
+void SSERVO_Update()
+{
+    SSERVO_SLOT *back;
+    uint8_t ch, s;
+    uint8_t changed = FALSE;
+
+    if(sservo_pending) return;
+
+    for(ch = 0; ch < SSERVO_CHANNELS; ch++)
+    {
+        if(sservo_count[ch] != sservo_built[ch])
+        {
+            sservo_built[ch] = sservo_count[ch];
+            changed = TRUE;
+        }
+    }
+    if(!changed) return;
+
+    back = sservo_sched[sservo_front ^ 1];
+    for(s = 0; s < SSERVO_USED_SLOTS; s++)
+        SSERVO_BuildSlot(&back[s], s);
+
+    sservo_pending = TRUE;
+}
+
+/* # Set up pins and start the timer
+
+   pins is a PROGMEM table of SSERVO_CHANNELS entries. The timer runs free
+   at /8 [0.5 us]; compare A marks slot starts and falling edges.
+*/
+void SSERVO_Init(const SSERVO_PIN *pins)
+{
+    volatile uint8_t *port;
+    uint8_t ch, mask;
+
+    sservo_pins = pins;
+
+    for(ch = 0; ch < SSERVO_CHANNELS; ch++)
+    {
+        port = (volatile uint8_t *) pgm_read_ptr(&pins[ch].port);
+        mask = pgm_read_byte(&pins[ch].mask);
+
+        /* low output; DDRx sits just below PORTx */
+        *port &= ~mask;
+        *(port - 1) |= mask;
+
+        sservo_order[ch / SSERVO_BANK][ch % SSERVO_BANK] = ch;
+
+        /* differs from any setpoint, forcing the first build */
+        sservo_built[ch] = 0xFFFF;
+    }
+
+    sservo_front = 0;
+    sservo_pending = FALSE;
+    SSERVO_Update();
+
+    /* normal mode, prescaler /8 */
+    TIMER_TCCRA(SSERVO_TIMER) = 0;
+    TIMER_TCCRB(SSERVO_TIMER) = (1 << CSn1);
+
+    sservo_slot = 0;
+    sservo_edge = SSERVO_SLOT_START;
+    sservo_start = SSERVO_TCNT + SSERVO_SLOT_TICKS;
+    SSERVO_OCRA = sservo_start;
+
+    /* clear pending flag and enable compare A interrupt */
+    SSERVO_TIFR = (1 << SSERVO_OCFA);
+    sethigh_1bit(SSERVO_TIMSK, SSERVO_OCIEA);
+}
+
+/* # Bind a PWM object to software channels 3 * group .. 3 * group + 2
+
+   Frequency and duty cycle read the same as the hardware preset
+   [SERVO_PWM]; compare values are converted to timer ticks on build.
+*/
+void SSERVO_Attach(PWM *pwm, uint8_t group)
+{
+    uint8_t chn_x;
+
+    pwm->timer = &sservo_timer;
+    pwm->prescalar = SERVO_PRESCALE_DIV;
+    pwm->counter_max = SERVO_TOP;
+    pwm->DDReg = NULL;
+
+    for(chn_x = chn_A; chn_x <= chn_C; chn_x++)
+        pwm->OCRnx[chn_x] = &sservo_count[3 * group + chn_x];
+}
+
+/* ----------------------------- */
+/*  Compare A interrupt handler  */
+/* ----------------------------- */
+
+/* # Slot start or falling edges
+
+   The rise time is read back from the counter, so interrupt latency at
+   the slot start shifts a pulse but does not change its width. Edges due
+   within SSERVO_MERGE are waited for and dropped in this interrupt, so
+   compare A is never set to a time that has already passed.
+*/
+ISR(SSERVO_VECT)
+{
+    SSERVO_SLOT *slot;
+    SSERVO_EDGE *edge;
+    uint16_t due;
+    uint8_t i;
+
+    if(sservo_slot < SSERVO_USED_SLOTS)
+    {
+        if(sservo_edge == SSERVO_SLOT_START)
+        {
+            /* a new frame takes the rebuilt schedule */
+            if(sservo_slot == 0 && sservo_pending)
+            {
+                sservo_front ^= 1;
+                sservo_pending = FALSE;
+            }
+
+            slot = &sservo_sched[sservo_front][sservo_slot];
+            sservo_t0 = SSERVO_TCNT;
+            for(i = 0; i < slot->n_rise; i++)
+                *slot->rise[i].port |= slot->rise[i].mask;
+            sservo_edge = 0;
+        }
+
+        slot = &sservo_sched[sservo_front][sservo_slot];
+        while(sservo_edge < slot->n_fall)
+        {
+            edge = &slot->fall[sservo_edge];
+            due = sservo_t0 + edge->time;
+
+            /* far enough away for another interrupt */
+            if((int16_t) (due - SSERVO_TCNT) > SSERVO_MERGE)
+            {
+                SSERVO_OCRA = due;
+                return;
+            }
+
+            while((int16_t) (due - SSERVO_TCNT) > 0)
+            ;
+            *edge->port &= ~edge->mask;
+            sservo_edge++;
+        }
+    }
+
+    /* slot done; slots start at fixed intervals whatever the latency */
+    sservo_start += SSERVO_SLOT_TICKS;
+    SSERVO_OCRA = sservo_start;
+    sservo_edge = SSERVO_SLOT_START;
+    if(++sservo_slot == SSERVO_SLOTS) sservo_slot = 0;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*==============================================================================
+  Header for the software servo driver
+
+    Description
+    -----------
+    Servo pulses on arbitrary port pins from one 16-bit timer's compare A
+    interrupt. The 20 ms frame is cut into SSERVO_SLOTS slots of 2.5 ms;
+    the channels of a slot [a bank of SSERVO_BANK] go high together at the
+    slot start and are dropped one by one in order of pulse width.
+
+    Each bank keeps its channels sorted, so when setpoints change the
+    schedule is rebuilt in O(n) [insertion sort of an almost sorted bank]
+    into a second buffer, which the interrupt takes over at the next frame
+    start. Widths are timed from the moment the pins actually went high,
+    so only the falling edges see interrupt latency; edges closer than
+    SSERVO_MERGE are dropped in the same interrupt.
+
+    Channels are grouped in threes behind PWM objects [SSERVO_Attach], so
+    the motion engine, commands and protocol drive them like the hardware
+    PWM channels; their compare registers are RAM setpoints here.
+
+ =============================================================================*/
+#ifndef SSERVO_H
+#define SSERVO_H
+
+#include <stdint.h>
+#include "pwm.h"
+
+/* 16-bit timer given to the driver [3, 4 or 5; timer1 keeps the motion
+   frame]. 0 builds no driver and leaves every timer to hardware PWM */
+#ifndef SSERVO_TIMER
+#define SSERVO_TIMER 5
+#endif
+
+/* number of software channels; a multiple of 3, at most
+   SSERVO_SLOTS * SSERVO_BANK */
+#if SSERVO_TIMER
+#ifndef SSERVO_CHANNELS
+#define SSERVO_CHANNELS 24
+#endif
+#else
+#undef SSERVO_CHANNELS
+#define SSERVO_CHANNELS 0
+#endif
+
+#define SSERVO_GROUPS (SSERVO_CHANNELS / 3)
+
+/* 8 slots of 2.5 ms per 20 ms frame, up to 8 pulses in each */
+#define SSERVO_SLOTS 8
+#define SSERVO_BANK 8
+
+/* timer ticks [prescaler /8, 0.5 us] */
+#define SSERVO_SLOT_TICKS 5000
+/* falling edges this close are handled in one interrupt */
+#define SSERVO_MERGE 32
+/* longest pulse leaves this much of the slot free */
+#define SSERVO_GUARD 100
+
+/* ticks per compare count of the hardware PWM preset [SERVO_PWM]; its
+   pulse is 2 * count * SERVO_PRESCALE_DIV / F_CPU in phase-correct mode */
+#define SSERVO_TICKS_PER_COUNT (2 * SERVO_PRESCALE_DIV / 8)
+
+#if SSERVO_CHANNELS % 3
+  #error SSERVO_CHANNELS is not a multiple of 3
+#endif
+#if SSERVO_CHANNELS > SSERVO_SLOTS * SSERVO_BANK
+  #error too many software servo channels for the frame
+#endif
+#if SSERVO_TIMER == 1
+  #error timer1 drives the motion frame
+#endif
+
+/* output pin of a software channel */
+typedef struct SSERVO_PIN
+{
+    volatile uint8_t * port;
+    uint8_t mask;
+} SSERVO_PIN;
+
+// Set up pins [PROGMEM table of SSERVO_CHANNELS] and start the timer
+extern void SSERVO_Init(const SSERVO_PIN *pins);
+
+// Bind a PWM object to software channels 3 * group .. 3 * group + 2
+extern void SSERVO_Attach(PWM *pwm, uint8_t group);
+
+// Rebuild the schedule if a setpoint changed [frame interrupt context]
+extern void SSERVO_Update(void);
+
+#endif
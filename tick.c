@@ -0,0 +1,174 @@
+/*==============================================================================
+  Function declarations and data structures for the system tick
+ =============================================================================*/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "global.h"
+#include "tick.h"
+
+/* ------------------ */
+/*  Extern variables  */
+/* ------------------ */
+
+volatile uint32_t tick_ms;
+
+/* ------------------ */
+/*  Static variables  */
+/* ------------------ */
+
+/* EVENT_TICK deadline [TICK_WakeAt]; written with interrupts off */
+static uint32_t tick_wake;
+
+/* sleep accounting; updated with interrupts off in TICK_Idle */
+static uint32_t tick_wakeups;
+static uint32_t tick_sleep_ms;
+static uint16_t tick_sleep_us;
+
+/* ---------------------- */
+/*  Function definitions  */
+/* ---------------------- */
+
+/* # Start the 1 ms tick
+
+   CTC mode, /64 prescaler: 250 counts of 4 us. Idle sleep is selected
+   here as well.
+*/
+void TICK_Init()
+{
+    tick_ms = 0;
+    tick_wake = 0;
+    tick_wakeups = 0;
+    tick_sleep_ms = 0;
+    tick_sleep_us = 0;
+
+    TCCR0A = (1 << WGM01);
+    TCCR0B = (1 << CS01) | (1 << CS00);
+    OCR0A = TICK_COUNTS - 1;
+    TCNT0 = 0;
+
+    /* clear pending flag and enable compare A interrupt */
+    TIFR0 = (1 << OCF0A);
+    sethigh_1bit(TIMSK0, OCIE0A);
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+uint32_t TICK_Ms()
+{
+    uint32_t ms;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ms = tick_ms;
+    }
+    return ms;
+}
+
+/* # Microseconds; interrupts off. A tick that is due but not yet counted
+   shows as a pending compare flag */
+static uint32_t TICK_UsLocked()
+{
+    uint8_t count = TCNT0;
+    uint32_t ms = tick_ms;
+
+    if((TIFR0 & (1 << OCF0A)) && count < TICK_COUNTS - 1)
+        ms++;
+    return ms * 1000 + (uint16_t) count * TICK_US_PER_COUNT;
+}
+
+uint32_t TICK_Us()
+{
+    uint32_t us;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        us = TICK_UsLocked();
+    }
+    return us;
+}
+
+/* # Raise EVENT_TICK once tick_ms reaches ms
+
+   A tick left over from an earlier deadline is cleared, so only the new
+   one wakes the scheduler.
+*/
+void TICK_WakeAt(uint32_t ms)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tick_wake = ms;
+        if((int32_t) (tick_ms - ms) >= 0)
+            events |= EVENT_TICK;
+        else
+            events &= ~EVENT_TICK;
+    }
+}
+
+/* # Sleep until an event in mask is raised
+
+   Events are tested with interrupts off and sleep entered right after
+   sei, which always runs the next instruction first; an interrupt
+   between the test and sleep_cpu therefore cannot be missed. The time
+   asleep includes the interrupt that ended it. The events are left set
+   for the caller to take.
+*/
+void TICK_Idle(uint8_t mask)
+{
+    uint32_t t0;
+
+    cli();
+    while(!(events & mask))
+    {
+        t0 = TICK_UsLocked();
+
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        cli();
+        tick_wakeups++;
+        tick_sleep_us += TICK_UsLocked() - t0;
+        while(tick_sleep_us >= 1000)
+        {
+            tick_sleep_us -= 1000;
+            tick_sleep_ms++;
+        }
+    }
+    sei();
+}
+
+uint32_t TICK_Wakeups()
+{
+    uint32_t n;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        n = tick_wakeups;
+    }
+    return n;
+}
+
+uint32_t TICK_SleepMs()
+{
+    uint32_t ms;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ms = tick_sleep_ms;
+    }
+    return ms;
+}
+
+/* ---------------------------- */
+/*  Compare A interrupt [1 ms]  */
+/* ---------------------------- */
+
+ISR(TIMER0_COMPA_vect)
+{
+    tick_ms++;
+    if((int32_t) (tick_ms - tick_wake) >= 0)
+        events |= EVENT_TICK;
+}
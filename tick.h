@@ -0,0 +1,47 @@
+/*==============================================================================
+  Header for the system tick and idle sleep
+
+    Description
+    -----------
+    Timer0 in CTC mode interrupts every millisecond and counts tick_ms.
+    EVENT_TICK is only raised once tick_ms reaches the deadline set with
+    TICK_WakeAt, so a sleeping scheduler is not woken every millisecond
+    when no timed task is due. The scheduler sleeps in idle mode [TICK_Idle] until an interrupt
+    raises one of the events it waits for; timers and USARTs keep running
+    while the CPU is stopped.
+
+    Every return from sleep counts as a wakeup, and the time between
+    going to sleep and waking is added to the sleep total, so the share of
+    time spent asleep gives the CPU duty cycle.
+
+ =============================================================================*/
+#ifndef TICK_H
+#define TICK_H
+
+#include <stdint.h>
+
+/* timer0 counts per tick [/64 prescaler, 4 us each] */
+#define TICK_COUNTS 250
+#define TICK_US_PER_COUNT 4
+
+/* milliseconds since TICK_Init */
+extern volatile uint32_t tick_ms;
+
+// Start the 1 ms tick [timer0 compare A]
+extern void TICK_Init(void);
+
+// Milliseconds / microseconds since TICK_Init
+extern uint32_t TICK_Ms(void);
+extern uint32_t TICK_Us(void);
+
+// Raise EVENT_TICK once tick_ms reaches ms [at once if it has]
+extern void TICK_WakeAt(uint32_t ms);
+
+// Sleep until an event in mask is raised [events are not cleared]
+extern void TICK_Idle(uint8_t mask);
+
+// Wakeups and time spent asleep since TICK_Init
+extern uint32_t TICK_Wakeups(void);
+extern uint32_t TICK_SleepMs(void);
+
+#endif
@@ -27,19 +27,19 @@ int TIMER_Init(TIMER *timer, uint8_t n)
     switch(n)
     {
         case 1:
-        timer->timer_reg_loc = (volatile uint8_t *) 0x80;
+        timer->timer_reg_loc = (volatile uint8_t *) TIMER_BASE(1);
         break;
 
         case 3:
-        timer->timer_reg_loc = (volatile uint8_t *) 0x90;
+        timer->timer_reg_loc = (volatile uint8_t *) TIMER_BASE(3);
         break;
 
         case 4:
-        timer->timer_reg_loc = (volatile uint8_t *) 0xA0;
+        timer->timer_reg_loc = (volatile uint8_t *) TIMER_BASE(4);
         break;
 
         case 5:
-        timer->timer_reg_loc = (volatile uint8_t *) 0x120;
+        timer->timer_reg_loc = (volatile uint8_t *) TIMER_BASE(5);
         break;
 
         default:
@@ -64,3 +64,20 @@ int TIMER_Init(TIMER *timer, uint8_t n)
     return 0;
 }
 
+/* # Hold all prescaled timers
+
+   Stops timers 0,1,3,4,5 by keeping their shared prescaler in reset
+   [GTCCR TSM, PSRSYNC]. Counters configured while held start counting on
+   the same clock edge in TIMER_SyncRelease, so their BOTTOM (and OCRnx
+   buffer update) coincides every frame.
+*/
+void TIMER_SyncHold()
+{
+    GTCCR = (1 << TSM) | (1 << PSRSYNC);
+}
+
+/* # Release timers held by TIMER_SyncHold */
+void TIMER_SyncRelease()
+{
+    GTCCR = 0;
+}
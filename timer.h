@@ -56,6 +56,27 @@
 #define FOCnB   6
 #define FOCnC   5
 
+/* # Compile-time register access
+
+   The same registers as the TIMER object, keyed by constant timer and
+   channel numbers so the compiler knows the address: a 16-bit write is
+   two sts instead of a pointer load and indirect stores. n = 1,3,4,5;
+   chn = 0,1,2 [chn_A..chn_C]. Use the TIMER object when the timer is
+   only known at run time.
+*/
+#define TIMER_BASE_1  0x80
+#define TIMER_BASE_3  0x90
+#define TIMER_BASE_4  0xA0
+#define TIMER_BASE_5  0x120
+#define TIMER_BASE(n) TIMER_BASE_##n
+
+#define TIMER_TCCRA(n)    _SFR_MEM8(TIMER_BASE(n) + _TCCRnA)
+#define TIMER_TCCRB(n)    _SFR_MEM8(TIMER_BASE(n) + _TCCRnB)
+#define TIMER_TCCRC(n)    _SFR_MEM8(TIMER_BASE(n) + _TCCRnC)
+#define TIMER_ICR(n)      _SFR_MEM16(TIMER_BASE(n) + _ICRn)
+#define TIMER_TCNT(n)     _SFR_MEM16(TIMER_BASE(n) + _TCNTn)
+#define TIMER_OCR(n, chn) _SFR_MEM16(TIMER_BASE(n) + _OCRnA + 2 * (chn))
+
 /* -------------- */
 /*  Timer Object  */
 /* -------------- */
@@ -85,4 +106,8 @@ typedef struct TIMER
 /* Constructor */
 extern int TIMER_Init(TIMER *timer, uint8_t n);
 
+/* Hold / release the shared prescaler so timers start in phase */
+extern void TIMER_SyncHold(void);
+extern void TIMER_SyncRelease(void);
+
 #endif
\ No newline at end of file
@@ -1,8 +1,11 @@
 /*==============================================================================
   Function declarations and data structures for the UART
  =============================================================================*/
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include "global.h"
 #include "uart.h"
 
@@ -14,251 +17,685 @@
 char UART_RxBuffer[UART_RX_BUFFER_SIZE];
 uint8_t UART_RxPtr;
 
-uint8_t UART_ID;
-
-/* data register */
-volatile uint8_t  *UDRn;
-
-/* control and status registers */
-volatile uint8_t *UCSRnA;
-volatile uint8_t *UCSRnB;
-volatile uint8_t *UCSRnC;
+/* port instances; registers bound here, rings and counters zeroed */
+#define _UART_PORT(n) \
+    { .UDRn = &UDR##n, .UCSRnA = &UCSR##n##A, .UCSRnB = &UCSR##n##B, \
+      .UCSRnC = &UCSR##n##C, .UBRRnL = &UBRR##n##L, .UBRRnH = &UBRR##n##H, \
+      .id = n }
+
+#if UART_USE_PORT0
+UART uart0 = _UART_PORT(0);
+#endif
+#if UART_USE_PORT1
+UART uart1 = _UART_PORT(1);
+#endif
+#if UART_USE_PORT2
+UART uart2 = _UART_PORT(2);
+#endif
+#if UART_USE_PORT3
+UART uart3 = _UART_PORT(3);
+#endif
+
+UART *uart_console;
 
 /* ------------------ */
 /*  Static variables  */
 /* ------------------ */
 
-/* TX buffer and head/tail pointers (idx counters) */
-static char UART_TxBuffer[UART_TX_BUFFER_SIZE];
-static volatile uint8_t UART_TxHead;
-static volatile uint8_t UART_TxTail;
-
-/* ===================== */
-/* Pointers to Registers */
-/* ===================== */
+/* default backpressure policy per TX stream */
+static const uint8_t UART_TxPolicyDefault[UART_N_STREAMS] PROGMEM = {
+    UART_TX_BLOCK, UART_TX_DROP_NEWEST
+};
 
-/* baud rate registers */
-static volatile uint16_t *UBRRn;
-static volatile uint8_t  *UBRRnL;
-static volatile uint8_t  *UBRRnH;
+/* supported rates; UBRRn and error worked out by the compiler */
+typedef struct UART_BAUD
+{
+    uint32_t baud;
+    uint16_t ubrr;
+    int16_t err;
+} UART_BAUD;
+
+#define _UART_BAUD_ENTRY(BAUD) \
+    { BAUD, UART_UBRR_U2X(BAUD), UART_BAUD_ERR_U2X(BAUD) }
+
+static const UART_BAUD UART_BaudTable[] PROGMEM = {
+    _UART_BAUD_ENTRY(9600UL),
+    _UART_BAUD_ENTRY(19200UL),
+    _UART_BAUD_ENTRY(38400UL),
+    _UART_BAUD_ENTRY(57600UL),
+    _UART_BAUD_ENTRY(76800UL),
+    _UART_BAUD_ENTRY(115200UL),
+    _UART_BAUD_ENTRY(250000UL),
+    _UART_BAUD_ENTRY(500000UL),
+    _UART_BAUD_ENTRY(1000000UL)
+};
+
+#define UART_BAUD_TABLE_LEN (sizeof(UART_BaudTable) / sizeof(UART_BAUD))
 
 /* ---------------------- */
 /*  Function definitions  */
 /* ---------------------- */
 
-void uart_Select(uint8_t uart_id)
+UART * UART_Port(uint8_t id)
 {
-    switch(uart_id)
+    switch(id)
     {
-        case 1:
-            UBRRn  = &UBRR1;
-            UBRRnL = &UBRR1L;
-            UBRRnH = &UBRR1H;
-            UDRn   = &UDR1;
-            UCSRnA = &UCSR1A;
-            UCSRnB = &UCSR1B;
-            UCSRnC = &UCSR1C;
-            UART_ID = 1;
-        break;
-
-        case 2:
-            UBRRn  = &UBRR2;
-            UBRRnL = &UBRR2L;
-            UBRRnH = &UBRR2H;
-            UDRn   = &UDR2;
-            UCSRnA = &UCSR2A;
-            UCSRnB = &UCSR2B;
-            UCSRnC = &UCSR2C;
-            UART_ID = 2;
-        break;
-
-        case 3:
-            UBRRn  = &UBRR3;
-            UBRRnL = &UBRR3L;
-            UBRRnH = &UBRR3H;
-            UDRn   = &UDR3;
-            UCSRnA = &UCSR3A;
-            UCSRnB = &UCSR3B;
-            UCSRnC = &UCSR3C;
-            UART_ID = 3;
-        break;
-
-        /* default is zero */
-        default:
-            UBRRn  = &UBRR0;
-            UBRRnL = &UBRR0L;
-            UBRRnH = &UBRR0H;
-            UDRn   = &UDR0;
-            UCSRnA = &UCSR0A;
-            UCSRnB = &UCSR0B;
-            UCSRnC = &UCSR0C;
-            UART_ID = 0;
-        break;
+#if UART_USE_PORT0
+        case 0: return &uart0;
+#endif
+#if UART_USE_PORT1
+        case 1: return &uart1;
+#endif
+#if UART_USE_PORT2
+        case 2: return &uart2;
+#endif
+#if UART_USE_PORT3
+        case 3: return &uart3;
+#endif
+        default: return NULL;
     }
 }
 
 
-void uart_Init(uint8_t uart_id)
+void UART_Init(UART *port)
 {
-    uart_Select(uart_id);
+    uint8_t i;
 
-    /* -- Set baud rates, refer to datasheet -- */
-    // 19.2 kbps trasfer speed running at 16 MHz.
-    #define BAUD 51
-    // 19.2 kbps trasfer speed running at 8 MHz.
-    //#define BAUD 25
-    // 19.2 kbps trasfer speed running at 3.6864 MHz.
-    // #define BAUD 11
+    /* Flush Buffers */
+    port->rx_tail = 0;
+    port->rx_head = 0;
+    port->tx_tail = 0;
+    port->tx_head = 0;
+    port->desc_tail = 0;
+    port->desc_head = 0;
+
+    for(i = 0; i < UART_N_STREAMS; i++)
+    {
+        port->tx_policy[i] = pgm_read_byte(&UART_TxPolicyDefault[i]);
+        port->tx_dropped[i] = 0;
+    }
 
-    *UBRRnH = (uint8_t)(BAUD>>8);
-    *UBRRnL = (uint8_t)BAUD;
+    port->rx_count.ring_overrun = 0;
+    port->rx_count.data_overrun = 0;
+    port->rx_count.frame_error = 0;
+
+    /* -- Set baud rate, see UART_BaudTable -- */
+    port->tx_sent = FALSE;
+    UART_SetBaud(port, UART_BAUD_DEFAULT);
 
     /* Enable receiver and transmitter, rx int */
-    *UCSRnB = (1<<RXENn)|(1<<TXENn)|(1<<RXCIEn)|(1<<TXCIEn);
- 
+    *port->UCSRnB = (1<<RXENn)|(1<<TXENn)|(1<<RXCIEn);
+
     /* Set frame format: 8data, 1stop bit */
-    *UCSRnC = (3<<UCSZn0);
+    *port->UCSRnC = (3<<UCSZn0);
+}
+
+/* # Bring up the console port; it must be built [UART_USE_PORTn] */
+void uart_Init(uint8_t uart_id)
+{
+    uart_console = UART_Port(uart_id);
+    UART_Init(uart_console);
 
-    /* Flush Buffers */
     UART_RxPtr = 0;
     UART_RxBuffer[0] = '\0';
-    UART_TxTail = 0;
-    UART_TxHead = 0;
 }
 
 
-void uart_SendByte(char data)
+/* # Switch baud rate
+
+   Waits for everything already queued to be shifted out at the old rate
+   [ring, descriptors and the TX shift register], then loads UBRRn with
+   double speed [U2Xn] on. Returns -1 if the rate is not in the table.
+*/
+int UART_SetBaud(UART *port, uint32_t baud)
+{
+    uint8_t i;
+    uint16_t ubrr;
+
+    for(i = 0; i < UART_BAUD_TABLE_LEN; i++)
+        if(pgm_read_dword(&UART_BaudTable[i].baud) == baud) break;
+
+    if(i == UART_BAUD_TABLE_LEN)
+        return -1;
+
+    /* flush TX */
+    while ( port->tx_head != port->tx_tail ||
+            port->desc_head != port->desc_tail )
+    ;
+    if ( port->tx_sent )
+        while ( !(*port->UCSRnA & (1 << TXCn)) )
+        ;
+
+    ubrr = pgm_read_word(&UART_BaudTable[i].ubrr);
+    *port->UBRRnH = (uint8_t)(ubrr>>8);
+    *port->UBRRnL = (uint8_t)ubrr;
+    *port->UCSRnA = (1 << U2Xn);
+
+    port->baud_idx = i;
+    return 0;
+}
+
+uint32_t UART_GetBaud(UART *port)
+{
+    return pgm_read_dword(&UART_BaudTable[port->baud_idx].baud);
+}
+
+/* # Rate error of the current setting [0.1 %] */
+int16_t UART_BaudError(UART *port)
+{
+    return pgm_read_word(&UART_BaudTable[port->baud_idx].err);
+}
+
+uint8_t uart_BaudTableLen()
+{
+    return UART_BAUD_TABLE_LEN;
+}
+
+uint32_t uart_BaudTableRate(uint8_t idx)
+{
+    return pgm_read_dword(&UART_BaudTable[idx].baud);
+}
+
+/* # Queue one byte of a stream if there is room; 1 if queued, 0 if full */
+static uint8_t UART_QueueByte(UART *port, uint8_t stream, char data)
 {
     uint8_t tmphead;
 
     /* Calculate buffer index */
-    tmphead = ( UART_TxHead + 1 ) & UART_TX_BUFFER_MASK;
-    /* Wait for free space in buffer */
-    while ( tmphead == UART_TxTail )
-    ;
-    /* Store data in buffer */
-    UART_TxBuffer[tmphead] = data;
+    tmphead = ( port->tx_head + 1 ) & UART_TX_BUFFER_MASK;
+    /* No free space in buffer */
+    if ( tmphead == port->tx_tail )
+        return 0;
+    /* Store data in buffer, tagged with its stream */
+    port->tx_ring[tmphead] = data;
+    if ( stream == UART_STREAM_ECHO )
+        port->tx_tag[tmphead >> 3] |= (1 << (tmphead & 7));
+    else
+        port->tx_tag[tmphead >> 3] &= ~(1 << (tmphead & 7));
     /* Store new index */
-    UART_TxHead = tmphead;
+    port->tx_head = tmphead;
     /* Enable UDRE interrupt */
-    SET_UDRIE;
+    SET_UDRIE(port);
+    return 1;
 }
 
+/* # Queue one reply byte if there is room; returns 1 if queued, 0 if full */
+uint8_t UART_TrySendByte(UART *port, char data)
+{
+    return UART_QueueByte(port, UART_STREAM_REPLY, data);
+}
 
-void uart_SendString(char Str[])
+/* # Queue as much of data as fits; returns the number of bytes queued */
+uint8_t UART_TrySend(UART *port, const char *data, uint8_t len)
+{
+    uint8_t n;
+
+    for(n = 0; n < len; n++)
+        if(!UART_TrySendByte(port, data[n])) break;
+    return n;
+}
+
+/* # Drop the oldest unsent ring byte if stream queued it
+
+   A stream only ever displaces its own bytes, so overwriting echo cannot
+   eat into a lossless reply. Not allowed either when a descriptor is
+   waiting on that position, since the ISR would never see the ring drain
+   up to it. Returns 1 on success.
+*/
+static uint8_t UART_DropOldest(UART *port, uint8_t stream)
+{
+    uint8_t dropped = 0;
+    uint8_t oldest, echo;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        oldest = ( port->tx_tail + 1 ) & UART_TX_BUFFER_MASK;
+        echo = ( port->tx_tag[oldest >> 3] >> (oldest & 7) ) & 1;
+
+        if ( port->tx_head != port->tx_tail &&
+             echo == ( stream == UART_STREAM_ECHO ) &&
+             ( port->desc_head == port->desc_tail ||
+               port->tx_desc[( port->desc_tail + 1 ) & UART_TX_DESC_MASK]
+                   .ring_end != port->tx_tail ) )
+        {
+            port->tx_tail = ( port->tx_tail + 1 ) & UART_TX_BUFFER_MASK;
+            dropped = 1;
+        }
+    }
+    return dropped;
+}
+
+/* # Send one byte on a stream, following the stream's policy
+
+   Returns 1 if the byte was queued, 0 if it was dropped.
+*/
+uint8_t UART_StreamSendByte(UART *port, uint8_t stream, char data)
+{
+    if(UART_QueueByte(port, stream, data))
+        return 1;
+
+    switch(port->tx_policy[stream])
+    {
+        case UART_TX_BLOCK:
+            /* Wait for free space in buffer */
+            while(!UART_QueueByte(port, stream, data))
+            ;
+        return 1;
+
+        case UART_TX_OVERWRITE_OLDEST:
+            /* the displaced byte is counted against this stream; with
+               another stream's byte oldest this is a drop of the new one */
+            if(UART_DropOldest(port, stream) && UART_QueueByte(port, stream, data))
+            {
+                port->tx_dropped[stream]++;
+                return 1;
+            }
+        break;
+    }
+
+    port->tx_dropped[stream]++;
+    return 0;
+}
+
+/* # Send len bytes on a stream; returns the number of bytes queued */
+uint8_t UART_StreamSend(UART *port, uint8_t stream,
+                        const char *data, uint8_t len)
+{
+    uint8_t n, queued = 0;
+
+    for(n = 0; n < len; n++)
+        queued += UART_StreamSendByte(port, stream, data[n]);
+    return queued;
+}
+
+void UART_SetTxPolicy(UART *port, uint8_t stream, uint8_t policy)
+{
+    if(stream < UART_N_STREAMS)
+        port->tx_policy[stream] = policy;
+}
+
+uint8_t UART_GetTxPolicy(UART *port, uint8_t stream)
+{
+    return port->tx_policy[stream];
+}
+
+/* # Send one byte on the reply stream [blocks by default] */
+void UART_SendByte(UART *port, char data)
+{
+    UART_StreamSendByte(port, UART_STREAM_REPLY, data);
+}
+
+
+void UART_SendString(UART *port, char Str[])
 {
     char * ptr;
     ptr = Str;
     while(*ptr)
     {
-       uart_SendByte(*ptr);
+       UART_SendByte(port, *ptr);
        ptr++;
     }
 }
 
-void uart_SendInt(int x)
+/* # Send a string stored in flash [PROGMEM / PSTR]
+
+   Long strings are queued as a descriptor and cost no copying; short
+   ones go through the ring where a descriptor would be larger.
+*/
+void UART_SendString_P(UART *port, const char *Str)
 {
-    static const char dec[] = "0123456789";
-    unsigned int div_val = 10000;
+    char c;
+    uint16_t len = strlen_P(Str);
 
-    if (x < 0)
+    if(len >= UART_TX_DESC_MIN)
     {
-        x = - x;
-        uart_SendByte('-');
+        UART_SendBlock_P(port, Str, len);
+        return;
     }
 
-    while (div_val > 1 && div_val > x)
-        div_val /= 10;
+    while((c = pgm_read_byte(Str++)))
+       UART_SendByte(port, c);
+}
+
+/* # Queue a block for transmission without copying it */
+static void UART_QueueBlock(UART *port, const char *data, uint16_t len,
+                            uint8_t flash)
+{
+    uint8_t tmphead;
+    UART_TX_DESC *desc;
+
+    if(len == 0) return;
 
-    do
+    /* Calculate queue index */
+    tmphead = ( port->desc_head + 1 ) & UART_TX_DESC_MASK;
+    /* Wait for a free descriptor, or drop the block per reply policy */
+    if ( tmphead == port->desc_tail &&
+         port->tx_policy[UART_STREAM_REPLY] != UART_TX_BLOCK )
     {
-        uart_SendByte (dec[x / div_val]);
-        x %= div_val;
-        div_val /= 10;
+        port->tx_dropped[UART_STREAM_REPLY] += len;
+        return;
     }
-    while(div_val);
+    while ( tmphead == port->desc_tail )
+    ;
+    /* Sent after every byte already in the ring */
+    desc = &port->tx_desc[tmphead];
+    desc->ptr = data;
+    desc->len = len;
+    desc->flash = flash;
+    desc->ring_end = port->tx_head;
+    /* Store new index */
+    port->desc_head = tmphead;
+    /* Enable UDRE interrupt */
+    SET_UDRIE(port);
 }
 
-void uart_FlushRxBuffer()
+/* # Queue a RAM block; it must stay unchanged until it has been sent */
+void UART_SendBlock(UART *port, const char *data, uint16_t len)
 {
-    UART_RxPtr = 0;
-    UART_RxBuffer[0] = '\0';
+    UART_QueueBlock(port, data, len, FALSE);
 }
 
-/* ---------------------- */
-/*  RX interrupt handler  */
-/* ---------------------  */
+/* # Queue a flash [PROGMEM] block */
+void UART_SendBlock_P(UART *port, const char *data, uint16_t len)
+{
+    UART_QueueBlock(port, data, len, TRUE);
+}
+
+/* ----------------------------------------------- */
+/*  Numeric output; written straight into the ring  */
+/* ----------------------------------------------- */
 
-/* alter as needed */
+/* powers of ten for digit extraction by repeated subtraction */
+static const uint32_t UART_Pow10[] PROGMEM = {
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
 
-ISR(USART0_RX_vect)
+static const char UART_HexDigit[] PROGMEM = "0123456789ABCDEF";
+
+/* # Decimal digits of x from UART_Pow10[idx] down to the units
+
+   Digits are extracted by subtracting the power of ten at most 9 times
+   each; no division, which the AVR does in software. Leading zeros are
+   skipped unless started is set.
+*/
+static void UART_SendDigits(UART *port, uint16_t x, uint8_t idx, uint8_t started)
 {
-    if(UART_ID == 0) status.rx_int = TRUE;
+    uint16_t p;
+    char digit;
+
+    for(; idx < sizeof(UART_Pow10) / sizeof(UART_Pow10[0]); idx++)
+    {
+        p = (uint16_t) pgm_read_dword(&UART_Pow10[idx]);
+        for(digit = '0'; x >= p; digit++) x -= p;
+
+        if(started || digit != '0')
+        {
+            UART_SendByte(port, digit);
+            started = TRUE;
+        }
+    }
+    UART_SendByte(port, '0' + x);
 }
 
-ISR(USART1_RX_vect)
+/* # Unsigned 16-bit decimal */
+void UART_SendUInt(UART *port, uint16_t x)
 {
-    if(UART_ID == 1) status.rx_int = TRUE;
+    /* table entries 5..8 are 10000..10 */
+    UART_SendDigits(port, x, 5, FALSE);
 }
 
-ISR(USART2_RX_vect)
+/* # Signed 16-bit decimal; full range including -32768 */
+void UART_SendInt(UART *port, int x)
 {
-    if(UART_ID == 2) status.rx_int = TRUE;
+    if (x < 0)
+    {
+        UART_SendByte(port, '-');
+        UART_SendUInt(port, - (uint16_t) x);
+    }
+    else UART_SendUInt(port, x);
 }
 
-ISR(USART3_RX_vect)
+/* # Unsigned 32-bit decimal */
+void UART_SendULong(UART *port, uint32_t x)
 {
-    if(UART_ID == 3) status.rx_int = TRUE;
+    uint32_t p;
+    uint8_t i;
+    char digit;
+    uint8_t started = FALSE;
+
+    if(x <= 0xFFFF)
+    {
+        UART_SendUInt(port, x);
+        return;
+    }
+
+    /* 1000000000..10000 in 32 bits, the rest fits the 16-bit loop */
+    for(i = 0; i < 6; i++)
+    {
+        p = pgm_read_dword(&UART_Pow10[i]);
+        for(digit = '0'; x >= p; digit++) x -= p;
+
+        if(started || digit != '0')
+        {
+            UART_SendByte(port, digit);
+            started = TRUE;
+        }
+    }
+    UART_SendDigits(port, x, 6, started);
 }
 
-/* ---------------------- */
-/*  TX interrupt handler  */
-/* ---------------------- */
+/* # Signed 32-bit decimal */
+void UART_SendLong(UART *port, int32_t x)
+{
+    if (x < 0)
+    {
+        UART_SendByte(port, '-');
+        UART_SendULong(port, - (uint32_t) x);
+    }
+    else UART_SendULong(port, x);
+}
 
-void _TransmitByte()
+/* # Hexadecimal, zero padded to n_digits [1..4] */
+void UART_SendHex(UART *port, uint16_t x, uint8_t n_digits)
 {
-    uint8_t UART_TxTail_tmp;
-    UART_TxTail_tmp = UART_TxTail;
+    while(n_digits--)
+        UART_SendByte(port,
+            pgm_read_byte(&UART_HexDigit[(x >> (4 * n_digits)) & 0x0F]));
+}
 
-    /* Check if all data is transmitted */
-    if ( UART_TxHead !=  UART_TxTail_tmp )
+/* # Signed binary fixed-point value as decimal
+
+   x has frac_bits fractional bits [<= 24]; decimals digits are printed
+   after the point, truncated. E.g. (0x3280, 8, 2) -> "50.50".
+*/
+void UART_SendFixed(UART *port, int32_t x, uint8_t frac_bits, uint8_t decimals)
+{
+    uint32_t mag = (x < 0) ? - (uint32_t) x : (uint32_t) x;
+    uint32_t mask = ((uint32_t) 1 << frac_bits) - 1;
+    uint32_t frac = mag & mask;
+
+    if (x < 0) UART_SendByte(port, '-');
+    UART_SendULong(port, mag >> frac_bits);
+
+    if(decimals == 0) return;
+    UART_SendByte(port, '.');
+
+    /* each *10 moves the next decimal digit above the binary point */
+    while(decimals--)
     {
-        /* Calculate buffer index */
-        UART_TxTail_tmp = ( UART_TxTail + 1 ) & UART_TX_BUFFER_MASK;
-        /* Store new index */
-        UART_TxTail =  UART_TxTail_tmp;
-        /* Start transmition */
-        *UDRn = UART_TxBuffer[ UART_TxTail_tmp];
+        frac = (frac << 3) + (frac << 1);
+        UART_SendByte(port, '0' + (frac >> frac_bits));
+        frac &= mask;
     }
-    else
-        /* Disable UDRE interrupt */
-        CLR_UDRIE;
 }
 
-/*  Activated by SendByte() and is turned off when TX buffer is empty */
+void uart_FlushRxBuffer()
+{
+    UART_RxPtr = 0;
+    UART_RxBuffer[0] = '\0';
+}
+
+/* # Number of bytes waiting in the RX ring */
+uint8_t UART_RxAvailable(UART *port)
+{
+    return ( port->rx_head - port->rx_tail ) & UART_RX_BUFFER_MASK;
+}
 
-/* alter as needed */
+/* # Pop one byte from the RX ring
 
-ISR(USART0_UDRE_vect)
+   Never blocks. Returns the byte (0..255) or -1 if the ring is empty.
+*/
+int UART_GetByte(UART *port)
 {
-    if(UART_ID == 0) _TransmitByte();
+    uint8_t tmptail;
+
+    if ( port->rx_head == port->rx_tail )
+        return -1;
+
+    /* Calculate buffer index */
+    tmptail = ( port->rx_tail + 1 ) & UART_RX_BUFFER_MASK;
+    /* Store new index */
+    port->rx_tail = tmptail;
+
+    return (uint8_t) port->rx_ring[tmptail];
 }
 
-ISR(USART1_UDRE_vect)
+/* # Discard everything still waiting in the RX ring */
+void UART_FlushRxRing(UART *port)
 {
-    if(UART_ID == 1) _TransmitByte();
+    port->rx_tail = port->rx_head;
 }
 
-ISR(USART2_UDRE_vect)
+/* ---------------------- */
+/*  RX interrupt handler  */
+/* ---------------------  */
+
+/* # RX interrupt body
+
+   Inlined into each port's vector with the instance and register
+   addresses as constants, so the handler works on fixed addresses just
+   like a single-port driver; there is no port lookup per byte.
+*/
+static inline __attribute__((always_inline))
+void UART_ReceiveByte(UART *port, volatile uint8_t *ucsra,
+                      volatile uint8_t *udr)
 {
-    if(UART_ID == 2) _TransmitByte();
+    uint8_t tmphead;
+    uint8_t flags;
+    char data;
+
+    /* error flags must be read before UDRn */
+    flags = *ucsra;
+    data = *udr;
+
+    if ( flags & (1 << DORn) ) port->rx_count.data_overrun++;
+    if ( flags & (1 << FEn) ) port->rx_count.frame_error++;
+
+    /* Calculate buffer index */
+    tmphead = ( port->rx_head + 1 ) & UART_RX_BUFFER_MASK;
+
+    /* Drop the byte if the ring is full */
+    if ( tmphead == port->rx_tail )
+    {
+        port->rx_count.ring_overrun++;
+    }
+    else
+    {
+        /* Store data in buffer */
+        port->rx_ring[tmphead] = data;
+        /* Store new index */
+        port->rx_head = tmphead;
+    }
+
+    events |= EVENT_RX;
 }
 
-ISR(USART3_UDRE_vect)
+/* ---------------------- */
+/*  TX interrupt handler  */
+/* ---------------------- */
+
+/* clear TXCn [write 1] so it flags the end of this byte; U2Xn kept */
+static inline __attribute__((always_inline))
+void UART_TxStarted(UART *port, volatile uint8_t *ucsra)
 {
-    if(UART_ID == 3) _TransmitByte();
+    *ucsra = (*ucsra & (1 << U2Xn)) | (1 << TXCn);
+    port->tx_sent = TRUE;
 }
 
+/* # UDRE interrupt body; inlined per port like UART_ReceiveByte */
+static inline __attribute__((always_inline))
+void UART_TransmitByte(UART *port, volatile uint8_t *ucsra,
+                       volatile uint8_t *ucsrb, volatile uint8_t *udr)
+{
+    uint8_t tx_tail;
+    uint8_t desc_tail;
+    UART_TX_DESC *desc;
+
+    tx_tail = port->tx_tail;
+    desc_tail = port->desc_tail;
+
+    /* Next descriptor is due once the ring has drained up to it */
+    if ( port->desc_head != desc_tail )
+    {
+        desc = &port->tx_desc[( desc_tail + 1 ) & UART_TX_DESC_MASK];
+        if ( desc->ring_end == tx_tail )
+        {
+            /* Start transmition */
+            *udr = desc->flash ? pgm_read_byte(desc->ptr) : *(desc->ptr);
+            UART_TxStarted(port, ucsra);
+            desc->ptr++;
+            /* Block done; store new index */
+            if ( --desc->len == 0 )
+                port->desc_tail = ( desc_tail + 1 ) & UART_TX_DESC_MASK;
+            return;
+        }
+    }
+
+    /* Check if all data is transmitted */
+    if ( port->tx_head != tx_tail )
+    {
+        /* Calculate buffer index */
+        tx_tail = ( tx_tail + 1 ) & UART_TX_BUFFER_MASK;
+        /* Store new index */
+        port->tx_tail = tx_tail;
+        /* Start transmition */
+        *udr = port->tx_ring[tx_tail];
+        UART_TxStarted(port, ucsra);
+    }
+    else
+        /* Disable UDRE interrupt */
+        setlow_1bit(*ucsrb, UDRIEn);
+}
+
+/* ---------------------------- */
+/*  Vectors of the built ports  */
+/* ---------------------------- */
+
+/* RX fills the port's ring; UDRE is activated by a send and turned off
+   when the port's ring and descriptor queue are empty */
+#define _UART_VECTORS(n) \
+    ISR(USART##n##_RX_vect) \
+    { \
+        UART_ReceiveByte(&uart##n, &UCSR##n##A, &UDR##n); \
+    } \
+    ISR(USART##n##_UDRE_vect) \
+    { \
+        UART_TransmitByte(&uart##n, &UCSR##n##A, &UCSR##n##B, &UDR##n); \
+    }
+
+#if UART_USE_PORT0
+_UART_VECTORS(0)
+#endif
+#if UART_USE_PORT1
+_UART_VECTORS(1)
+#endif
+#if UART_USE_PORT2
+_UART_VECTORS(2)
+#endif
+#if UART_USE_PORT3
+_UART_VECTORS(3)
+#endif
+
 /*  Activated when TX is complete */
 EMPTY_INTERRUPT(USART0_TX_vect);
 EMPTY_INTERRUPT(USART1_TX_vect);
@@ -273,4 +710,4 @@ ISR(BADISR_vect)
 {
     /* flip blink state */
     flip_1bit(PORTB,DDB7);
-}
\ No newline at end of file
+}
@@ -6,18 +6,77 @@
 #ifndef UART_H
 #define UART_H
 
+#ifndef F_CPU
+// Require CPU freq 16 MHz
+#define F_CPU 16000000UL
+#endif
+
+/* --------------------- */
+/*  Baud rate selection  */
+/* --------------------- */
+
+/* rate set by uart_Init */
+#define UART_BAUD_DEFAULT 19200UL
+
+/* UBRRn and signed rate error [0.1 %] in double speed mode [U2Xn]:
+   baud = F_CPU / (8 * (UBRRn + 1)) */
+#define UART_UBRR_U2X(BAUD) \
+    ( ( F_CPU + 4UL * (BAUD) ) / ( 8UL * (BAUD) ) - 1 )
+#define UART_BAUD_ERR_U2X(BAUD) \
+    ( (int16_t) ( ( 1000L * (long) ( F_CPU / ( 8UL * ( UART_UBRR_U2X(BAUD) + 1 ) ) ) \
+    - 1000L * (long) (BAUD) ) / (long) (BAUD) ) )
+
 /* -----------------------*/
 /*  UART Buffers defines  */
 /* -----------------------*/
 #define UART_RX_BUFFER_SIZE 128
 #define UART_RX_BUFFER_MASK ( UART_RX_BUFFER_SIZE - 1 )
-#define UART_TX_BUFFER_SIZE 64
+#define UART_TX_BUFFER_SIZE 128
 #define UART_TX_BUFFER_MASK ( UART_TX_BUFFER_SIZE - 1 )
 
 /*  String buffer from uart. Parsing is done in main()  */
 extern char UART_RxBuffer[UART_RX_BUFFER_SIZE];
 extern uint8_t UART_RxPtr;
 
+/* RX error / overrun counters, incremented in the RX interrupt */
+struct UART_RX_COUNTERS {
+  /* byte dropped because the RX ring was full */
+  uint16_t ring_overrun;
+  /* byte lost in hardware before the ISR ran [DORn] */
+  uint16_t data_overrun;
+  /* framing errors [FEn] */
+  uint16_t frame_error;
+};
+
+/* TX descriptor queue; (pointer, length) blocks sent by the UDRE ISR */
+#define UART_TX_DESC_SIZE 32
+#define UART_TX_DESC_MASK ( UART_TX_DESC_SIZE - 1 )
+
+/* flash strings shorter than this are copied into the ring instead */
+#define UART_TX_DESC_MIN 8
+
+/* TX streams; each has its own policy for a full ring */
+enum uart_streams
+{
+  UART_STREAM_REPLY, UART_STREAM_ECHO
+};
+#define UART_N_STREAMS 2
+
+/* one tag bit per TX ring byte records its stream */
+#define UART_TX_TAG_SIZE ( UART_TX_BUFFER_SIZE / 8 )
+
+/* TX backpressure policies */
+enum uart_tx_policies
+{
+  /* wait for space [default for replies] */
+  UART_TX_BLOCK,
+  /* discard the byte being sent */
+  UART_TX_DROP_NEWEST,
+  /* discard the oldest unsent ring byte to make room, if it is one of
+     the stream's own; otherwise the byte being sent */
+  UART_TX_OVERWRITE_OLDEST
+};
+
 /* check power of 2 size */
 #if ( UART_RX_BUFFER_SIZE & UART_RX_BUFFER_MASK )
   #error RX buffer size is not a power of 2
@@ -25,23 +84,9 @@ extern uint8_t UART_RxPtr;
 #if ( UART_TX_BUFFER_SIZE & UART_TX_BUFFER_MASK )
   #error TX buffer size is not a power of 2
 #endif
-
-/* data register */
-extern volatile uint8_t  *UDRn;
-
-/* control and status registers */
-extern volatile uint8_t *UCSRnA;
-extern volatile uint8_t *UCSRnB;
-extern volatile uint8_t *UCSRnC;
-
-/* alias */
-#define UART_UDRn UDRn
-#define UART_UCSRnA UCSRnA
-#define UART_UCSRnB UCSRnB
-#define UART_UCSRnC UCSRnC
-
-/* selected UART data register: set by uart init */
-extern uint8_t UART_ID;
+#if ( UART_TX_DESC_SIZE & UART_TX_DESC_MASK )
+  #error TX descriptor queue size is not a power of 2
+#endif
 
 /* fixed bit positions */
 
@@ -76,16 +121,180 @@ extern uint8_t UART_ID;
 #define UCPOLn  0
 
 /* UDR empty interrupt */
-#define SET_UDRIE sethigh_1bit(*UART_UCSRnB, UDRIEn)
-#define CLR_UDRIE setlow_1bit(*UART_UCSRnB, UDRIEn)
+#define SET_UDRIE(port) sethigh_1bit(*(port)->UCSRnB, UDRIEn)
+#define CLR_UDRIE(port) setlow_1bit(*(port)->UCSRnB, UDRIEn)
+
+/* ---------------- */
+/*  UART instances  */
+/* ---------------- */
+
+/* Ports built with rings and interrupt handlers. A disabled port costs
+   no RAM and its vectors stay unbound; override with -DUART_USE_PORTn */
+#ifndef UART_USE_PORT0
+#define UART_USE_PORT0 0
+#endif
+#ifndef UART_USE_PORT1
+#define UART_USE_PORT1 1
+#endif
+#ifndef UART_USE_PORT2
+#define UART_USE_PORT2 1
+#endif
+#ifndef UART_USE_PORT3
+#define UART_USE_PORT3 0
+#endif
+
+/* TX descriptor; a block sent in place, once the ring has drained up to
+   ring_end [the ring head when the block was queued] */
+typedef struct UART_TX_DESC
+{
+    const char * ptr;
+    uint16_t len;
+    uint8_t ring_end;
+    uint8_t flash;
+} UART_TX_DESC;
+
+/* One USART: registers, rings, descriptor queue and counters */
+typedef struct UART
+{
+    /* registers, fixed per instance */
+    volatile uint8_t *UDRn;
+    volatile uint8_t *UCSRnA;
+    volatile uint8_t *UCSRnB;
+    volatile uint8_t *UCSRnC;
+    volatile uint8_t *UBRRnL;
+    volatile uint8_t *UBRRnH;
+    uint8_t id;
+
+    /* RX ring filled by the RX interrupt, drained by UART_GetByte() */
+    char rx_ring[UART_RX_BUFFER_SIZE];
+    volatile uint8_t rx_head;
+    volatile uint8_t rx_tail;
+
+    /* TX ring and head/tail pointers (idx counters) */
+    char tx_ring[UART_TX_BUFFER_SIZE];
+    volatile uint8_t tx_head;
+    volatile uint8_t tx_tail;
+
+    /* stream of each ring byte; bit set for UART_STREAM_ECHO */
+    uint8_t tx_tag[UART_TX_TAG_SIZE];
+
+    /* TX descriptor queue */
+    UART_TX_DESC tx_desc[UART_TX_DESC_SIZE];
+    volatile uint8_t desc_head;
+    volatile uint8_t desc_tail;
+
+    /* set once the UDRE ISR has written UDRn; TXCn is meaningful after */
+    volatile uint8_t tx_sent;
+
+    /* index of the current rate in the baud table */
+    uint8_t baud_idx;
+
+    /* backpressure policy per TX stream, and bytes it discarded */
+    uint8_t tx_policy[UART_N_STREAMS];
+    uint16_t tx_dropped[UART_N_STREAMS];
+
+    volatile struct UART_RX_COUNTERS rx_count;
+} UART;
+
+#if UART_USE_PORT0
+extern UART uart0;
+#endif
+#if UART_USE_PORT1
+extern UART uart1;
+#endif
+#if UART_USE_PORT2
+extern UART uart2;
+#endif
+#if UART_USE_PORT3
+extern UART uart3;
+#endif
+
+/* port the uart_* interface works on; set by uart_Init */
+extern UART *uart_console;
 
 /* ----------------- */
-/*  uart interfaces  */
+/*  port interfaces  */
 /* ----------------- */
+
+/* instance for USARTn, or NULL if the port is not built */
+extern UART * UART_Port(uint8_t id);
+
+extern void UART_Init(UART *port);
+extern void UART_SendByte(UART *port, char data);
+extern void UART_SendString(UART *port, char text[]);
+extern void UART_SendString_P(UART *port, const char *text);
+extern void UART_SendBlock(UART *port, const char *data, uint16_t len);
+extern void UART_SendBlock_P(UART *port, const char *data, uint16_t len);
+
+/* baud rate; only rates in the compile-time table are accepted */
+extern int UART_SetBaud(UART *port, uint32_t baud);
+extern uint32_t UART_GetBaud(UART *port);
+extern int16_t UART_BaudError(UART *port);
+extern uint8_t uart_BaudTableLen(void);
+extern uint32_t uart_BaudTableRate(uint8_t idx);
+
+/* non-blocking sends; return the number of bytes queued */
+extern uint8_t UART_TrySendByte(UART *port, char data);
+extern uint8_t UART_TrySend(UART *port, const char *data, uint8_t len);
+
+/* per-stream sends, following the stream's policy */
+extern uint8_t UART_StreamSendByte(UART *port, uint8_t stream, char data);
+extern uint8_t UART_StreamSend(UART *port, uint8_t stream,
+                               const char *data, uint8_t len);
+extern void UART_SetTxPolicy(UART *port, uint8_t stream, uint8_t policy);
+extern uint8_t UART_GetTxPolicy(UART *port, uint8_t stream);
+
+/* numeric output */
+extern void UART_SendInt(UART *port, int data);
+extern void UART_SendUInt(UART *port, uint16_t data);
+extern void UART_SendLong(UART *port, int32_t data);
+extern void UART_SendULong(UART *port, uint32_t data);
+extern void UART_SendHex(UART *port, uint16_t data, uint8_t n_digits);
+extern void UART_SendFixed(UART *port, int32_t data,
+                           uint8_t frac_bits, uint8_t decimals);
+
+/* non-blocking RX ring access; UART_GetByte returns -1 when empty */
+extern uint8_t UART_RxAvailable(UART *port);
+extern int UART_GetByte(UART *port);
+extern void UART_FlushRxRing(UART *port);
+
+/* -------------------------------- */
+/*  uart interfaces [console port]  */
+/* -------------------------------- */
 extern void uart_Init(uint8_t);
-extern void uart_SendByte(char data);
-extern void uart_SendString(char text[]);
-extern void uart_SendInt(int data);
 extern void uart_FlushRxBuffer(void);
 
+#define uart_SendByte(data)            UART_SendByte(uart_console, data)
+#define uart_SendString(text)          UART_SendString(uart_console, text)
+#define uart_SendString_P(text)        UART_SendString_P(uart_console, text)
+#define uart_SendBlock(data, len)      UART_SendBlock(uart_console, data, len)
+#define uart_SendBlock_P(data, len)    UART_SendBlock_P(uart_console, data, len)
+
+#define uart_SetBaud(baud)             UART_SetBaud(uart_console, baud)
+#define uart_GetBaud()                 UART_GetBaud(uart_console)
+#define uart_BaudError()               UART_BaudError(uart_console)
+
+#define uart_TrySendByte(data)         UART_TrySendByte(uart_console, data)
+#define uart_TrySend(data, len)        UART_TrySend(uart_console, data, len)
+
+#define uart_StreamSendByte(stream, data) \
+    UART_StreamSendByte(uart_console, stream, data)
+#define uart_StreamSend(stream, data, len) \
+    UART_StreamSend(uart_console, stream, data, len)
+#define uart_SetTxPolicy(stream, policy) \
+    UART_SetTxPolicy(uart_console, stream, policy)
+#define uart_GetTxPolicy(stream)       UART_GetTxPolicy(uart_console, stream)
+
+#define uart_SendInt(data)             UART_SendInt(uart_console, data)
+#define uart_SendUInt(data)            UART_SendUInt(uart_console, data)
+#define uart_SendLong(data)            UART_SendLong(uart_console, data)
+#define uart_SendULong(data)           UART_SendULong(uart_console, data)
+#define uart_SendHex(data, n_digits)   UART_SendHex(uart_console, data, n_digits)
+#define uart_SendFixed(data, frac_bits, decimals) \
+    UART_SendFixed(uart_console, data, frac_bits, decimals)
+
+#define uart_RxAvailable()             UART_RxAvailable(uart_console)
+#define uart_GetByte()                 UART_GetByte(uart_console)
+#define uart_FlushRxRing()             UART_FlushRxRing(uart_console)
+
 #endif